@@ -1188,8 +1188,34 @@ struct sched_rt_entity {
 #endif
 };
 
+/*
+ * SCHED_FLASH priorities, set through sched_param.sched_priority: 0 (the
+ * default) to MAX_USER_FLASH_PRIO-1, higher is more important. Kept in
+ * rt_priority, as for SCHED_FIFO/SCHED_RR.
+ */
+#define MAX_USER_FLASH_PRIO	64
+
 struct sched_flash_entity {
 	struct list_head list;
+	pid_t fork_parent;	/* FLASH parent whose slot a child inherits */
+	unsigned char registered;	/* device slot allocated at fork */
+	unsigned char batched;		/* device update left to a batch */
+	unsigned char attr_stale;	/* attributes set outside the class */
+	unsigned char dev_tag;		/* device that knows dev_cpu */
+	int dev_cpu;			/* CPU last sent to that device */
+	unsigned int time_slice;	/* ticks left when no device decides */
+	u64 util_stamp;			/* rq->clock of util_avg */
+	u32 util_avg;			/* decayed runnable load, 0-1024 */
+	int numa_node;			/* node holding its memory */
+	/* sched_flash_setattr(), 0 for the defaults */
+	u16 weight;
+	u8 latency;
+	u32 slice_us;
+	u8 gang;			/* SCHED_FLASH_FLAG_GANG */
+	u64 dl_runtime, dl_deadline, dl_period;	/* EDF parameters, ns */
+	unsigned long dl_bw;		/* admitted share, 0 when not EDF */
+	u64 deadline;			/* absolute, rq->clock */
+	s64 runtime;			/* left before deadline */
 };
 
 struct rcu_node;
@@ -2057,6 +2083,8 @@ extern int sched_setscheduler(struct task_struct *, int,
 			      const struct sched_param *);
 extern int sched_setscheduler_nocheck(struct task_struct *, int,
 				      const struct sched_param *);
+extern int sched_flash_setattr(struct task_struct *,
+			       const struct sched_flash_attr *);
 extern struct task_struct *idle_task(int cpu);
 /**
  * is_idle_task - is the specified task an idle task?
@@ -1,6 +1,8 @@
 #ifndef _UAPI_LINUX_SCHED_H
 #define _UAPI_LINUX_SCHED_H
 
+#include <linux/types.h>
+
 /*
  * cloning flags:
  */
@@ -43,5 +45,57 @@
 #define SCHED_FLASH		7
 #define SCHED_RESET_ON_FORK     0x40000000
 
+/*
+ * Per-thread SCHED_FLASH attributes, sched_flash_setattr(2) and
+ * sched_flash_getattr(2). They are kept whatever the policy and take
+ * effect while the thread is SCHED_FLASH; zero is the default of each.
+ */
+struct sched_flash_attr {
+	__u32 size;		/* sizeof(struct sched_flash_attr) */
+	__u32 weight;		/* share of its priority level, 1 to
+				   SCHED_FLASH_WEIGHT_MAX; 0 from nice */
+	__u32 latency;		/* SCHED_FLASH_LATENCY_* */
+	__u32 slice_us;		/* slice asked for, up to
+				   SCHED_FLASH_SLICE_MAX_US; 0 default */
+
+	/*
+	 * Earliest-deadline-first: a thread that declares runtime_ns gets
+	 * that much CPU time every period_ns, before an absolute deadline
+	 * deadline_ns after each period starts, and FLASH picks it ahead of
+	 * every thread without one. 0 < runtime_ns <= deadline_ns <=
+	 * period_ns <= SCHED_FLASH_DL_PERIOD_MAX_NS; a zero deadline_ns or
+	 * period_ns is taken from the other. The runtime/period shares of
+	 * all SCHED_FLASH threads must fit the CPUs' FLASH bandwidth
+	 * (sched_flash_runtime_us/sched_flash_period_us each), or the call,
+	 * or sched_setscheduler(SCHED_FLASH) once the thread joins, fails
+	 * with EBUSY. Needs CAP_SYS_NICE; all zero for none.
+	 */
+	__u64 runtime_ns;
+	__u64 deadline_ns;
+	__u64 period_ns;
+
+	__u64 flags;		/* SCHED_FLASH_FLAG_* */
+};
+
+#define SCHED_FLASH_ATTR_SIZE_VER0	16	/* sizeof first published struct */
+#define SCHED_FLASH_ATTR_SIZE_VER1	40	/* add runtime, deadline, period */
+#define SCHED_FLASH_ATTR_SIZE_VER2	48	/* add flags */
+
+#define SCHED_FLASH_WEIGHT_MAX		65535
+#define SCHED_FLASH_SLICE_MAX_US	1000000
+#define SCHED_FLASH_DL_RUNTIME_MIN_NS	1024
+#define SCHED_FLASH_DL_PERIOD_MAX_NS	4000000000ULL
+
+#define SCHED_FLASH_LATENCY_NORMAL	0
+#define SCHED_FLASH_LATENCY_SENSITIVE	1	/* prefers short waits */
+#define SCHED_FLASH_LATENCY_CRITICAL	2	/* CAP_SYS_NICE only */
+#define SCHED_FLASH_LATENCY_BATCH	3	/* throughput, waits longest */
+
+/*
+ * Gang scheduling: the threads of a thread group that set this are run
+ * together, one per CPU they are queued on, where the device supports it.
+ */
+#define SCHED_FLASH_FLAG_GANG		0x1
+
 
 #endif /* _UAPI_LINUX_SCHED_H */
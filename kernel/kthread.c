@@ -17,6 +17,9 @@
 #include <linux/slab.h>
 #include <linux/freezer.h>
 #include <linux/ptrace.h>
+#include <linux/string.h>
+#include <linux/init.h>
+#include <linux/sched/rt.h>
 #include <trace/events/sched.h>
 
 static DEFINE_SPINLOCK(kthread_create_lock);
@@ -196,6 +199,116 @@ static void create_kthread(struct kthread_create_info *create)
 	}
 }
 
+/*
+ * Scheduling policy of new kernel threads, chosen by name.  The rules
+ * come from kthread_sched= on the command line, a comma-separated list
+ * of name:policy[:prio] where policy is normal, flash, fifo or rr, prio
+ * is the RT priority for fifo and rr or the FLASH priority for flash,
+ * and a trailing '*' in name matches any suffix.  A name must fit in
+ * a task's comm.  The first matching rule wins; a thread that matches
+ * none gets kthreadd's SCHED_FLASH or SCHED_NORMAL as before.  For example
+ *
+ *	kthread_sched=ksoftirqd*:flash,kworker*:normal,kcryptd*:fifo:10
+ *
+ * IRQ threads set their own SCHED_FIFO policy after creation, so rules
+ * for "irq/" threads are overridden by the IRQ core.
+ */
+#define KTHREAD_SCHED_RULES	16
+
+struct kthread_sched_rule {
+	char pattern[TASK_COMM_LEN];
+	int policy;
+	int prio;
+};
+
+static struct kthread_sched_rule kthread_sched_rules[KTHREAD_SCHED_RULES];
+static int nr_kthread_sched_rules;
+
+static const struct {
+	const char *name;
+	int policy;
+} kthread_sched_policies[] = {
+	{ "normal",	SCHED_NORMAL },
+	{ "flash",	SCHED_FLASH },
+	{ "fifo",	SCHED_FIFO },
+	{ "rr",		SCHED_RR },
+};
+
+static int __init kthread_sched_parse(struct kthread_sched_rule *r, char *rule)
+{
+	char *name, *policy;
+	int i;
+
+	name = strsep(&rule, ":");
+	policy = strsep(&rule, ":");
+	if (!*name || !policy || strlen(name) >= TASK_COMM_LEN)
+		return -EINVAL;
+
+	r->policy = -1;
+	for (i = 0; i < ARRAY_SIZE(kthread_sched_policies); i++)
+		if (!strcmp(policy, kthread_sched_policies[i].name))
+			r->policy = kthread_sched_policies[i].policy;
+	if (r->policy < 0)
+		return -EINVAL;
+
+	r->prio = 0;
+	if (rule && kstrtoint(rule, 10, &r->prio))
+		return -EINVAL;
+	if (r->policy == SCHED_FIFO || r->policy == SCHED_RR) {
+		if (r->prio < 1 || r->prio > MAX_USER_RT_PRIO - 1)
+			return -EINVAL;
+	} else if (r->policy == SCHED_FLASH) {
+		if (r->prio < 0 || r->prio > MAX_USER_FLASH_PRIO - 1)
+			return -EINVAL;
+	} else if (r->prio) {
+		return -EINVAL;
+	}
+
+	strlcpy(r->pattern, name, sizeof(r->pattern));
+	return 0;
+}
+
+static int __init kthread_sched_setup(char *str)
+{
+	char *rule;
+
+	while ((rule = strsep(&str, ",")) != NULL) {
+		if (!*rule)
+			continue;
+		if (nr_kthread_sched_rules == KTHREAD_SCHED_RULES) {
+			pr_warn("kthread_sched: too many rules, ignoring '%s'\n",
+				rule);
+			break;
+		}
+		if (kthread_sched_parse(&kthread_sched_rules[nr_kthread_sched_rules],
+					rule)) {
+			pr_warn("kthread_sched: bad rule '%s'\n", rule);
+			continue;
+		}
+		nr_kthread_sched_rules++;
+	}
+
+	return 1;
+}
+__setup("kthread_sched=", kthread_sched_setup);
+
+static const struct kthread_sched_rule *kthread_sched_rule(const char *comm)
+{
+	const struct kthread_sched_rule *r;
+	size_t len;
+
+	for (r = kthread_sched_rules;
+	     r < kthread_sched_rules + nr_kthread_sched_rules; r++) {
+		len = strlen(r->pattern);
+		if (r->pattern[len - 1] == '*' ?
+		    !strncmp(r->pattern, comm, len - 1) :
+		    !strcmp(r->pattern, comm))
+			return r;
+	}
+
+	return NULL;
+}
+
 /**
  * kthread_create_on_node - create a kthread.
  * @threadfn: the function to run until signal_pending(current).
@@ -239,6 +352,7 @@ struct task_struct *kthread_create_on_node(int (*threadfn)(void *data),
 
 	if (!IS_ERR(create.result)) {
 		static const struct sched_param param = { .sched_priority = 0 };
+		const struct kthread_sched_rule *rule;
 		va_list args;
 
 		va_start(args, namefmt);
@@ -247,9 +361,18 @@ struct task_struct *kthread_create_on_node(int (*threadfn)(void *data),
 		va_end(args);
 		/*
 		 * root may have changed our (kthreadd's) priority or CPU mask.
-		 * The kernel thread should not inherit these properties.
+		 * The kernel thread should not inherit these properties, but
+		 * may have its own from kthread_sched=.
 		 */
-		if (create.result->policy == SCHED_FLASH)
+		rule = kthread_sched_rule(create.result->comm);
+		if (rule) {
+			struct sched_param rparam = {
+				.sched_priority = rule->prio,
+			};
+
+			sched_setscheduler_nocheck(create.result, rule->policy,
+						   &rparam);
+		} else if (create.result->policy == SCHED_FLASH)
 			sched_setscheduler_nocheck(create.result, SCHED_FLASH, &param);
 		else
 			sched_setscheduler_nocheck(create.result, SCHED_NORMAL, &param);
@@ -1577,6 +1577,20 @@ static void __sched_fork(struct task_struct *p)
 #endif
 
 	INIT_LIST_HEAD(&p->rt.run_list);
+	INIT_LIST_HEAD(&p->flash.list);
+	/* The device has yet to hear which CPU this PID is on */
+	p->flash.dev_tag = 0;
+	/* A parent caught in a cgroup switch does not hand its batch on */
+	p->flash.batched = 0;
+	p->flash.attr_stale = 0;
+	/* Load is the child's own, counted from its first enqueue */
+	p->flash.util_avg = 0;
+	p->flash.util_stamp = 0;
+	/* Set by task_fork_flash() or the first FLASH enqueue */
+	p->flash.numa_node = NUMA_NO_NODE;
+	/* An EDF reservation is not inherited */
+	p->flash.dl_runtime = p->flash.dl_deadline = p->flash.dl_period = 0;
+	p->flash.dl_bw = 0;
 
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
@@ -1642,15 +1656,30 @@ void sched_fork(struct task_struct *p)
 	 */
 	if (unlikely(p->sched_reset_on_fork)) {
 		if (task_has_rt_policy(p)) {
-			p->policy = SCHED_NORMAL;
-			/* TODO p->policy = SCHED_FLASH; */
+			if (sysctl_sched_flash_reset_on_fork == FLASH_RESET_TO_FLASH)
+				p->policy = SCHED_FLASH;
+			else
+				p->policy = SCHED_NORMAL;
 			p->static_prio = NICE_TO_PRIO(0);
 			p->rt_priority = 0;
-		} else if (PRIO_TO_NICE(p->static_prio) < 0)
+		} else if (p->policy == SCHED_FLASH &&
+			   sysctl_sched_flash_reset_on_fork == FLASH_RESET_TO_NORMAL) {
+			p->policy = SCHED_NORMAL;
 			p->static_prio = NICE_TO_PRIO(0);
+			p->rt_priority = 0;
+		} else {
+			if (PRIO_TO_NICE(p->static_prio) < 0)
+				p->static_prio = NICE_TO_PRIO(0);
+			/* A FLASH child keeps the class, not the priority */
+			p->rt_priority = 0;
+		}
 
 		p->prio = p->normal_prio = __normal_prio(p);
 		set_load_weight(p);
+		p->flash.weight = 0;
+		p->flash.latency = 0;
+		p->flash.slice_us = 0;
+		p->flash.gang = 0;
 
 		/*
 		 * We don't need the reset flag anymore after the fork. It has
@@ -1713,6 +1742,14 @@ void wake_up_new_task(struct task_struct *p)
 	unsigned long flags;
 	struct rq *rq;
 
+	/*
+	 * The child has a PID by now: give the FLASH device its slot before
+	 * any runqueue lock is taken, so the enqueue below only has to mark
+	 * it runnable.
+	 */
+	if (p->sched_class == &flash_sched_class)
+		flash_fork_register(p);
+
 	raw_spin_lock_irqsave(&p->pi_lock, flags);
 #ifdef CONFIG_SMP
 	/*
@@ -1866,6 +1903,8 @@ static void finish_task_switch(struct rq *rq, struct task_struct *prev)
 		 * task and put them back on the free list.
 		 */
 		kprobe_flush_task(prev);
+		if (prev->flash.dl_bw)
+			flash_edf_release(prev);
 		put_task_struct(prev);
 	}
 }
@@ -3606,6 +3645,8 @@ void rt_mutex_setprio(struct task_struct *p, int prio)
 
 	if (rt_prio(prio))
 		p->sched_class = &rt_sched_class;
+	else if (p->policy == SCHED_FLASH)
+		p->sched_class = &flash_sched_class;
 	else
 		p->sched_class = &fair_sched_class;
 
@@ -3791,6 +3832,10 @@ static struct task_struct *find_process_by_pid(pid_t pid)
 static void
 __setscheduler(struct rq *rq, struct task_struct *p, int policy, int prio)
 {
+	/* Leaving SCHED_FLASH gives back any EDF share */
+	if (p->flash.dl_bw && policy != SCHED_FLASH)
+		flash_edf_release(p);
+
 	p->policy = policy;
 	p->rt_priority = prio;
 	p->normal_prio = normal_prio(p);
@@ -3798,7 +3843,7 @@ __setscheduler(struct rq *rq, struct task_struct *p, int policy, int prio)
 	p->prio = rt_mutex_getprio(p);
 	if (rt_prio(p->prio))
 		p->sched_class = &rt_sched_class;
-	else if (p->sched_class == SCHED_FLASH)
+	else if (p->policy == SCHED_FLASH)
 		p->sched_class = &flash_sched_class;
 	else
 		p->sched_class = &fair_sched_class;
@@ -3849,14 +3894,17 @@ recheck:
 
 	/*
 	 * Valid priorities for SCHED_FIFO and SCHED_RR are
-	 * 1..MAX_USER_RT_PRIO-1, valid priority for SCHED_NORMAL,
-	 * SCHED_BATCH and SCHED_IDLE is 0.
+	 * 1..MAX_USER_RT_PRIO-1, for SCHED_FLASH 0..MAX_USER_FLASH_PRIO-1,
+	 * valid priority for SCHED_NORMAL, SCHED_BATCH and SCHED_IDLE is 0.
 	 */
 	if (param->sched_priority < 0 ||
 	    (p->mm && param->sched_priority > MAX_USER_RT_PRIO-1) ||
 	    (!p->mm && param->sched_priority > MAX_RT_PRIO-1))
 		return -EINVAL;
-	if (rt_policy(policy) != (param->sched_priority != 0))
+	if (policy == SCHED_FLASH) {
+		if (param->sched_priority > MAX_USER_FLASH_PRIO-1)
+			return -EINVAL;
+	} else if (rt_policy(policy) != (param->sched_priority != 0))
 		return -EINVAL;
 
 	/*
@@ -3877,6 +3925,16 @@ recheck:
 				return -EPERM;
 		}
 
+		/*
+		 * Raising a FLASH priority is bounded by RLIMIT_RTPRIO too,
+		 * but anyone may switch to SCHED_FLASH at priority 0.
+		 */
+		if (policy == SCHED_FLASH &&
+		    param->sched_priority > (p->policy == SCHED_FLASH ?
+					     p->rt_priority : 0) &&
+		    param->sched_priority > task_rlimit(p, RLIMIT_RTPRIO))
+			return -EPERM;
+
 		/*
 		 * Treat SCHED_IDLE as nice 20. Only allow a switch to
 		 * SCHED_NORMAL if the RLIMIT_NICE would normally permit it.
@@ -3921,8 +3979,9 @@ recheck:
 	/*
 	 * If not changing anything there's no need to proceed further:
 	 */
-	if (unlikely(policy == p->policy && (!rt_policy(policy) ||
-			param->sched_priority == p->rt_priority))) {
+	if (unlikely(policy == p->policy &&
+		     ((!rt_policy(policy) && policy != SCHED_FLASH) ||
+		      param->sched_priority == p->rt_priority))) {
 		task_rq_unlock(rq, p, &flags);
 		return 0;
 	}
@@ -3948,6 +4007,20 @@ recheck:
 		task_rq_unlock(rq, p, &flags);
 		goto recheck;
 	}
+
+	/*
+	 * A task with EDF parameters (sched_flash_setattr()) joining
+	 * SCHED_FLASH needs its share of the CPUs admitted first.
+	 */
+	if (policy == SCHED_FLASH && p->policy != SCHED_FLASH &&
+	    p->flash.dl_runtime) {
+		retval = flash_edf_admit(p, flash_edf_bw(p->flash.dl_runtime,
+							 p->flash.dl_period));
+		if (retval) {
+			task_rq_unlock(rq, p, &flags);
+			return retval;
+		}
+	}
 	on_rq = p->on_rq;
 	running = task_current(rq, p);
 	if (on_rq)
@@ -4118,6 +4191,250 @@ out_unlock:
 	return retval;
 }
 
+/*
+ * Copy a struct sched_flash_attr from user space. An older binary may pass
+ * a shorter one, whose missing fields read as zero (the defaults), a newer
+ * one a longer one as long as the fields this kernel does not know are
+ * zero; otherwise the size we support is written back and -E2BIG returned.
+ */
+static int sched_copy_flash_attr(struct sched_flash_attr __user *uattr,
+				 struct sched_flash_attr *attr)
+{
+	u32 size;
+	int ret;
+
+	if (!access_ok(VERIFY_WRITE, uattr, SCHED_FLASH_ATTR_SIZE_VER0))
+		return -EFAULT;
+
+	memset(attr, 0, sizeof(*attr));
+
+	ret = get_user(size, &uattr->size);
+	if (ret)
+		return ret;
+
+	if (size > PAGE_SIZE || size < SCHED_FLASH_ATTR_SIZE_VER0)
+		goto err_size;
+
+	if (size > sizeof(*attr)) {
+		unsigned char __user *addr;
+		unsigned char __user *end;
+		unsigned char val;
+
+		addr = (void __user *)uattr + sizeof(*attr);
+		end  = (void __user *)uattr + size;
+
+		for (; addr < end; addr++) {
+			ret = get_user(val, addr);
+			if (ret)
+				return ret;
+			if (val)
+				goto err_size;
+		}
+		size = sizeof(*attr);
+	}
+
+	if (copy_from_user(attr, uattr, size))
+		return -EFAULT;
+
+	return 0;
+
+err_size:
+	put_user(sizeof(*attr), &uattr->size);
+	return -E2BIG;
+}
+
+static int __sched_flash_setattr(struct task_struct *p,
+				 const struct sched_flash_attr *attr, bool user)
+{
+	u64 dl_deadline = attr->deadline_ns ? : attr->period_ns;
+	u64 dl_period = attr->period_ns ? : attr->deadline_ns;
+	int retval = 0, on_rq = 0, running = 0;
+	unsigned long flags;
+	bool dl_changed;
+	struct rq *rq;
+
+	if (attr->weight > SCHED_FLASH_WEIGHT_MAX ||
+	    attr->latency > SCHED_FLASH_LATENCY_BATCH ||
+	    attr->slice_us > SCHED_FLASH_SLICE_MAX_US ||
+	    attr->flags & ~SCHED_FLASH_FLAG_GANG)
+		return -EINVAL;
+
+	if (attr->runtime_ns ?
+	    (attr->runtime_ns < SCHED_FLASH_DL_RUNTIME_MIN_NS ||
+	     attr->runtime_ns > dl_deadline || dl_deadline > dl_period ||
+	     dl_period > SCHED_FLASH_DL_PERIOD_MAX_NS) :
+	    dl_period)
+		return -EINVAL;
+
+	dl_changed = attr->runtime_ns != p->flash.dl_runtime ||
+		     dl_deadline != p->flash.dl_deadline ||
+		     dl_period != p->flash.dl_period;
+
+	/*
+	 * As with nice, unprivileged threads may ask for less but not for
+	 * more: no weight above nice 0's or their current one, and no
+	 * critical latency class they do not already have.
+	 */
+	if (user && !capable(CAP_SYS_NICE)) {
+		if (attr->weight > max_t(u32, p->flash.weight, NICE_0_LOAD))
+			return -EPERM;
+		if (attr->latency == SCHED_FLASH_LATENCY_CRITICAL &&
+		    p->flash.latency != SCHED_FLASH_LATENCY_CRITICAL)
+			return -EPERM;
+		/* A CPU reservation is for the administrator to hand out */
+		if (attr->runtime_ns && dl_changed)
+			return -EPERM;
+		if (!check_same_owner(p))
+			return -EPERM;
+	}
+
+	if (user) {
+		retval = security_task_setscheduler(p);
+		if (retval)
+			return retval;
+	}
+
+	rq = task_rq_lock(p, &flags);
+
+	/*
+	 * A SCHED_FLASH task's new EDF share has to be admitted, with the
+	 * task off the runqueue so that its deadline is redone on the way
+	 * back; other tasks are admitted when they join SCHED_FLASH. A
+	 * reservation that was never admitted is tried again.
+	 */
+	if (p->policy == SCHED_FLASH &&
+	    (dl_changed || (attr->runtime_ns && !p->flash.dl_bw))) {
+		bool flash = p->sched_class == &flash_sched_class;
+
+		on_rq = flash && p->on_rq;
+		running = flash && task_current(rq, p);
+		if (on_rq)
+			dequeue_task(rq, p, 0);
+		if (running)
+			p->sched_class->put_prev_task(rq, p);
+
+		retval = flash_edf_admit(p, flash_edf_bw(attr->runtime_ns,
+							 dl_period));
+	}
+
+	if (!retval) {
+		p->flash.weight = attr->weight;
+		p->flash.latency = attr->latency;
+		p->flash.slice_us = attr->slice_us;
+		p->flash.gang = !!(attr->flags & SCHED_FLASH_FLAG_GANG);
+		p->flash.dl_runtime = attr->runtime_ns;
+		p->flash.dl_deadline = dl_deadline;
+		p->flash.dl_period = dl_period;
+		/*
+		 * A task out of the class, PI-boosted say, is told once it
+		 * is back, by switched_to_flash().
+		 */
+		if (p->sched_class == &flash_sched_class)
+			flash_attr_changed(p);
+		else
+			p->flash.attr_stale = 1;
+	}
+
+	if (running)
+		p->sched_class->set_curr_task(rq);
+	if (on_rq)
+		enqueue_task(rq, p, 0);
+	task_rq_unlock(rq, p, &flags);
+
+	return retval;
+}
+
+/**
+ * sched_flash_setattr - set the SCHED_FLASH attributes of a thread from kernelspace.
+ * @p: the task in question.
+ * @attr: the new weight, latency class, slice, EDF parameters and
+ *	flags; attr->size is ignored.
+ *
+ * No permission checks, as sched_setscheduler_nocheck().
+ */
+int sched_flash_setattr(struct task_struct *p,
+			const struct sched_flash_attr *attr)
+{
+	return __sched_flash_setattr(p, attr, false);
+}
+EXPORT_SYMBOL_GPL(sched_flash_setattr);
+
+/**
+ * sys_sched_flash_setattr - set the SCHED_FLASH attributes of a thread
+ * @pid: the pid in question.
+ * @uattr: structure containing the attributes.
+ * @flags: for future extension, must be 0.
+ */
+SYSCALL_DEFINE3(sched_flash_setattr, pid_t, pid,
+		struct sched_flash_attr __user *, uattr, unsigned int, flags)
+{
+	struct sched_flash_attr attr;
+	struct task_struct *p;
+	int retval;
+
+	if (!uattr || pid < 0 || flags)
+		return -EINVAL;
+
+	retval = sched_copy_flash_attr(uattr, &attr);
+	if (retval)
+		return retval;
+
+	rcu_read_lock();
+	retval = -ESRCH;
+	p = find_process_by_pid(pid);
+	if (p != NULL)
+		retval = __sched_flash_setattr(p, &attr, true);
+	rcu_read_unlock();
+
+	return retval;
+}
+
+/**
+ * sys_sched_flash_getattr - get the SCHED_FLASH attributes of a thread
+ * @pid: the pid in question.
+ * @uattr: structure to fill in.
+ * @size: sizeof(*uattr) as the caller knows it.
+ * @flags: for future extension, must be 0.
+ */
+SYSCALL_DEFINE4(sched_flash_getattr, pid_t, pid,
+		struct sched_flash_attr __user *, uattr, unsigned int, size,
+		unsigned int, flags)
+{
+	struct sched_flash_attr attr = { };
+	struct task_struct *p;
+	int retval;
+
+	if (!uattr || pid < 0 || flags || size > PAGE_SIZE ||
+	    size < SCHED_FLASH_ATTR_SIZE_VER0)
+		return -EINVAL;
+
+	rcu_read_lock();
+	p = find_process_by_pid(pid);
+	retval = -ESRCH;
+	if (!p)
+		goto out_unlock;
+
+	retval = security_task_getscheduler(p);
+	if (retval)
+		goto out_unlock;
+
+	attr.size = min_t(unsigned int, size, sizeof(attr));
+	attr.weight = p->flash.weight;
+	attr.latency = p->flash.latency;
+	attr.slice_us = p->flash.slice_us;
+	attr.runtime_ns = p->flash.dl_runtime;
+	attr.deadline_ns = p->flash.dl_deadline;
+	attr.period_ns = p->flash.dl_period;
+	attr.flags = p->flash.gang ? SCHED_FLASH_FLAG_GANG : 0;
+	rcu_read_unlock();
+
+	return copy_to_user(uattr, &attr, attr.size) ? -EFAULT : 0;
+
+out_unlock:
+	rcu_read_unlock();
+	return retval;
+}
+
 long sched_setaffinity(pid_t pid, const struct cpumask *in_mask)
 {
 	cpumask_var_t cpus_allowed, new_mask;
@@ -4528,10 +4845,12 @@ SYSCALL_DEFINE1(sched_get_priority_max, int, policy)
 	case SCHED_RR:
 		ret = MAX_USER_RT_PRIO-1;
 		break;
+	case SCHED_FLASH:
+		ret = MAX_USER_FLASH_PRIO-1;
+		break;
 	case SCHED_NORMAL:
 	case SCHED_BATCH:
 	case SCHED_IDLE:
-	case SCHED_FLASH:
 		ret = 0;
 		break;
 	}
@@ -4913,6 +5232,55 @@ static void calc_load_migrate(struct rq *rq)
 		atomic_long_add(delta, &calc_load_tasks);
 }
 
+/*
+ * FLASH tasks go first and in bulk: everything that can run on the least
+ * loaded active CPU is moved there with a single device message, rather
+ * than having the device pick each one only to have it dequeued and
+ * enqueued again. Whatever has a narrower affinity is moved one by one.
+ */
+static void migrate_flash_tasks(struct rq *rq, unsigned int dead_cpu)
+{
+	struct task_struct *p;
+	int cpu, dest_cpu = -1;
+
+	if (!rq->flash.nr_running)
+		return;
+
+	/* Keep the tasks next to their memory if the node has a CPU left */
+	for_each_cpu_and(cpu, cpumask_of_node(cpu_to_node(dead_cpu)),
+			 cpu_active_mask) {
+		if (dest_cpu < 0 || cpu_rq(cpu)->flash.util_sum <
+				    cpu_rq(dest_cpu)->flash.util_sum)
+			dest_cpu = cpu;
+	}
+	if (dest_cpu < 0) {
+		for_each_cpu(cpu, cpu_active_mask) {
+			if (dest_cpu < 0 || cpu_rq(cpu)->flash.util_sum <
+					    cpu_rq(dest_cpu)->flash.util_sum)
+				dest_cpu = cpu;
+		}
+	}
+
+	if (dest_cpu >= 0) {
+		struct rq *dest_rq = cpu_rq(dest_cpu);
+
+		double_lock_balance(rq, dest_rq);
+		move_queued_flash_tasks(rq, dest_rq);
+		double_unlock_balance(rq, dest_rq);
+	}
+
+	while (!list_empty(&rq->flash.queue)) {
+		p = list_first_entry(&rq->flash.queue, struct task_struct,
+				     flash.list);
+		dest_cpu = select_fallback_rq(dead_cpu, p);
+		raw_spin_unlock(&rq->lock);
+
+		__migrate_task(p, dead_cpu, dest_cpu);
+
+		raw_spin_lock(&rq->lock);
+	}
+}
+
 /*
  * Migrate all tasks from the rq, sleeping tasks will be migrated by
  * try_to_wake_up()->select_task_rq().
@@ -4938,6 +5306,8 @@ static void migrate_tasks(unsigned int dead_cpu)
 	 */
 	rq->stop = NULL;
 
+	migrate_flash_tasks(rq, dead_cpu);
+
 	for ( ; ; ) {
 		/*
 		 * There's this thread running, bail when that's the only
@@ -5250,6 +5620,9 @@ static int __cpuinit sched_cpu_inactive(struct notifier_block *nfb,
 {
 	switch (action & ~CPU_TASKS_FROZEN) {
 	case CPU_DOWN_PREPARE:
+		/* The CPUs left must carry every admitted FLASH EDF share */
+		if (!(action & CPU_TASKS_FROZEN) && flash_edf_cpu_busy())
+			return notifier_from_errno(-EBUSY);
 		set_cpu_active((long)hcpu, false);
 		return NOTIFY_OK;
 	default:
@@ -6928,6 +7301,8 @@ void __init sched_init(void)
 
 	init_rt_bandwidth(&def_rt_bandwidth,
 			global_rt_period(), global_rt_runtime());
+	init_flash_bandwidth(&def_flash_bandwidth,
+			global_flash_period(), global_flash_runtime());
 
 #ifdef CONFIG_RT_GROUP_SCHED
 	init_rt_bandwidth(&root_task_group.rt_bandwidth,
@@ -6938,6 +7313,7 @@ void __init sched_init(void)
 	list_add(&root_task_group.list, &task_groups);
 	INIT_LIST_HEAD(&root_task_group.children);
 	INIT_LIST_HEAD(&root_task_group.siblings);
+	root_task_group.flash_weight = FLASH_WEIGHT_DEFAULT;
 	autogroup_init(&init_task);
 
 #endif /* CONFIG_CGROUP_SCHED */
@@ -7166,6 +7542,100 @@ void normalize_rt_tasks(void)
 
 #endif /* CONFIG_MAGIC_SYSRQ */
 
+/*
+ * Switch @p, with its pi_lock and rq->lock held, between SCHED_NORMAL
+ * and SCHED_FLASH, as __sched_setscheduler() would.
+ */
+static void flash_switch_task(struct rq *rq, struct task_struct *p, int policy)
+{
+	const struct sched_class *prev_class = p->sched_class;
+	int old_prio = p->prio;
+	int on_rq, running;
+
+	/*
+	 * As in __sched_setscheduler(), an EDF reservation is admitted on
+	 * the way in; one that does not fit is dropped rather than left
+	 * looking granted.
+	 */
+	if (policy == SCHED_FLASH && p->flash.dl_runtime && !p->flash.dl_bw &&
+	    flash_edf_admit(p, flash_edf_bw(p->flash.dl_runtime,
+					    p->flash.dl_period)))
+		p->flash.dl_runtime = p->flash.dl_deadline =
+			p->flash.dl_period = 0;
+
+	on_rq = p->on_rq;
+	running = task_current(rq, p);
+	if (on_rq)
+		dequeue_task(rq, p, 0);
+	if (running)
+		p->sched_class->put_prev_task(rq, p);
+
+	__setscheduler(rq, p, policy, 0);
+
+	if (running)
+		p->sched_class->set_curr_task(rq);
+	if (on_rq)
+		enqueue_task(rq, p, 0);
+
+	check_class_changed(rq, p, prev_class, old_prio);
+}
+
+/*
+ * Move init and every other user task still on SCHED_NORMAL over to
+ * SCHED_FLASH, for sched_flash=default once a device is there to
+ * schedule them. Kernel threads and tasks with any other policy are
+ * left alone; whatever is forked afterwards inherits the policy.
+ */
+void sched_flash_make_default(void)
+{
+	struct task_struct *g, *p;
+	unsigned long flags;
+	struct rq *rq;
+
+	read_lock_irqsave(&tasklist_lock, flags);
+	do_each_thread(g, p) {
+		if (!p->mm || p->policy != SCHED_NORMAL)
+			continue;
+
+		raw_spin_lock(&p->pi_lock);
+		rq = __task_rq_lock(p);
+
+		flash_switch_task(rq, p, SCHED_FLASH);
+
+		__task_rq_unlock(rq);
+		raw_spin_unlock(&p->pi_lock);
+	} while_each_thread(g, p);
+
+	read_unlock_irqrestore(&tasklist_lock, flags);
+}
+
+/*
+ * Announce every FLASH task to a FLASH device that has just registered,
+ * see flash_resync_device().
+ */
+void sched_flash_resync(struct flash_dev *dev)
+{
+	struct task_struct *g, *p;
+	unsigned long flags;
+	struct rq *rq;
+
+	read_lock_irqsave(&tasklist_lock, flags);
+	do_each_thread(g, p) {
+		if (p->sched_class != &flash_sched_class)
+			continue;
+
+		raw_spin_lock(&p->pi_lock);
+		rq = __task_rq_lock(p);
+
+		flash_resync_task(dev, p);
+
+		__task_rq_unlock(rq);
+		raw_spin_unlock(&p->pi_lock);
+	} while_each_thread(g, p);
+
+	read_unlock_irqrestore(&tasklist_lock, flags);
+}
+
 #if defined(CONFIG_IA64) || defined(CONFIG_KGDB_KDB)
 /*
  * These functions are only useful for the IA64 MCA handling, or kdb.
@@ -7326,6 +7796,10 @@ void sched_move_task(struct task_struct *tsk)
 #endif
 		set_task_rq(tsk, task_cpu(tsk));
 
+	/*
+	 * A FLASH task is re-registered with the device under its new
+	 * group id when it is enqueued again, here or at its next wakeup.
+	 */
 	if (unlikely(running))
 		tsk->sched_class->set_curr_task(rq);
 	if (on_rq)
@@ -7663,10 +8137,15 @@ static int cpu_cgroup_css_online(struct cgroup *cgrp)
 {
 	struct task_group *tg = cgroup_tg(cgrp);
 	struct task_group *parent;
+	int ret;
 
 	if (!cgrp->parent)
 		return 0;
 
+	ret = online_flash_sched_group(tg);
+	if (ret)
+		return ret;
+
 	parent = cgroup_tg(cgrp->parent);
 	sched_online_group(tg, parent);
 	return 0;
@@ -7683,6 +8162,7 @@ static void cpu_cgroup_css_offline(struct cgroup *cgrp)
 {
 	struct task_group *tg = cgroup_tg(cgrp);
 
+	offline_flash_sched_group(tg);
 	sched_offline_group(tg);
 }
 
@@ -7697,7 +8177,8 @@ static int cpu_cgroup_can_attach(struct cgroup *cgrp,
 			return -EINVAL;
 #else
 		/* We don't support RT-tasks being in separate groups */
-		if (task->sched_class != &fair_sched_class)
+		if (task->sched_class != &fair_sched_class &&
+		    task->sched_class != &flash_sched_class)
 			return -EINVAL;
 #endif
 	}
@@ -7974,6 +8455,87 @@ static int cpu_stats_show(struct cgroup *cgrp, struct cftype *cft,
 #endif /* CONFIG_CFS_BANDWIDTH */
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
+static int cpu_flash_weight_write_u64(struct cgroup *cgrp,
+				      struct cftype *cftype, u64 weight)
+{
+	return sched_group_set_flash_weight(cgroup_tg(cgrp), weight);
+}
+
+static u64 cpu_flash_weight_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_tg(cgrp)->flash_weight;
+}
+
+/*
+ * Switch every SCHED_NORMAL user task of @cgrp to SCHED_FLASH (or every
+ * SCHED_FLASH one back) in one pass; kernel threads are left alone, as
+ * by sched_flash_make_default(). While they are switched their
+ * enqueues and dequeues send nothing to the device; it is brought up to
+ * date afterwards with one batch of @nr registrations, which it applies
+ * at once, instead of one unannounced registration per task.
+ */
+static int sched_cgroup_set_flash(struct cgroup *cgrp, int policy)
+{
+	int from = policy == SCHED_FLASH ? SCHED_NORMAL : SCHED_FLASH;
+	struct task_struct *p, **tasks;
+	struct cgroup_iter it;
+	unsigned long flags;
+	int i, n, nr = 0;
+	struct rq *rq;
+
+	n = cgroup_task_count(cgrp);
+	if (!n)
+		return 0;
+
+	tasks = kmalloc(n * sizeof(*tasks), GFP_KERNEL);
+	if (!tasks)
+		return -ENOMEM;
+
+	/* Anything forked after this inherits the policy from its parent */
+	cgroup_iter_start(cgrp, &it);
+	while (nr < n && (p = cgroup_iter_next(cgrp, &it))) {
+		if (!p->mm || p->policy != from)
+			continue;
+		get_task_struct(p);
+		tasks[nr++] = p;
+	}
+	cgroup_iter_end(cgrp, &it);
+
+	for (i = 0; i < nr; i++) {
+		p = tasks[i];
+		rq = task_rq_lock(p, &flags);
+		/* Only the tasks switched here are left to the batch */
+		if (p->policy == from) {
+			p->flash.batched = 1;
+			flash_switch_task(rq, p, policy);
+		}
+		task_rq_unlock(rq, p, &flags);
+	}
+
+	flash_batch_begin();
+	for (i = 0; i < nr; i++) {
+		p = tasks[i];
+		rq = task_rq_lock(p, &flags);
+		if (p->flash.batched)
+			flash_batch_task(p);
+		task_rq_unlock(rq, p, &flags);
+		put_task_struct(p);
+	}
+	flash_batch_end();
+
+	kfree(tasks);
+	return 0;
+}
+
+static int cpu_flash_policy_write_u64(struct cgroup *cgrp,
+				      struct cftype *cftype, u64 flash)
+{
+	if (flash > 1)
+		return -EINVAL;
+
+	return sched_cgroup_set_flash(cgrp, flash ? SCHED_FLASH : SCHED_NORMAL);
+}
+
 #ifdef CONFIG_RT_GROUP_SCHED
 static int cpu_rt_runtime_write(struct cgroup *cgrp, struct cftype *cft,
 				s64 val)
@@ -8034,6 +8596,15 @@ static struct cftype cpu_files[] = {
 		.write_u64 = cpu_rt_period_write_uint,
 	},
 #endif
+	{
+		.name = "flash_weight",
+		.read_u64 = cpu_flash_weight_read_u64,
+		.write_u64 = cpu_flash_weight_write_u64,
+	},
+	{
+		.name = "flash_policy",
+		.write_u64 = cpu_flash_policy_write_u64,
+	},
 	{ }	/* terminate */
 };
 
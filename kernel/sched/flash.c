@@ -4,32 +4,1134 @@
 #include <asm/io.h>
 #include <linux/printk.h>
 #include <linux/export.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
+#include <linux/init.h>
+#include <linux/sysctl.h>
+#include <linux/relay.h>
+#include <linux/debugfs.h>
+#include <linux/topology.h>
+#include <linux/pid_namespace.h>
 #include "flash_dev.h"
 
-struct flash_dev *flash = NULL;
-EXPORT_SYMBOL(flash);
+/*
+
+sched_flash=default on the command line makes SCHED_FLASH the policy of all
+userspace. Until a device has probed, FLASH tasks only get the software
+round-robin fallback, so boot runs on CFS as usual; when the first device
+registers, init and every user task still on SCHED_NORMAL are handed over by
+sched_flash_make_default() and everything forked after that inherits the
+policy.
+
+*/
+
+static bool flash_default_policy;
+
+static int __init sched_flash_setup(char *str)
+{
+	if (!strcmp(str, "default"))
+		flash_default_policy = true;
+	else
+		printk(KERN_WARNING "sched_flash: unknown option '%s'\n", str);
+
+	return 1;
+}
+__setup("sched_flash=", sched_flash_setup);
+
+/*
+
+FLASH devices. A machine may have several scheduler coprocessors, say one per
+socket. Each device schedules the CPUs in its cpumask and every flash_rq talks
+only to the device that owns its CPU, so a device never hears about, or picks,
+a task queued on another device's CPUs. A CPU no device owns runs its FLASH
+tasks round-robin in software. Moving a task between devices' CPUs is a
+removal on one device and a new task on the other.
+
+Devices come and go while FLASH tasks run. rq->flash.dev and flash_devs[] are
+RCU pointers: the class reads them with preemption disabled (under rq->lock,
+or rcu_read_lock_sched() elsewhere), and unregistering waits for a sched grace
+period, so once flash_unregister_device() returns nothing calls into the
+device any more and its CPUs are back on the software queues. A device that
+registers is first told the state of everything already running on its CPUs,
+see flash_resync_device().
+
+*/
+
+static struct flash_dev __rcu *flash_devs[FLASH_MAX_DEVS];
+static DEFINE_MUTEX(flash_devs_mutex);
+
+static inline struct flash_dev *flash_cpu_dev(int cpu)
+{
+	return rcu_dereference_sched(cpu_rq(cpu)->flash.dev);
+}
+
+static void flash_bind_cpus(struct flash_dev *dev, struct flash_dev *to)
+{
+	int cpu;
+
+	for_each_cpu(cpu, &dev->cpus)
+		rcu_assign_pointer(cpu_rq(cpu)->flash.dev, to);
+}
+
+static void flash_resync_device(struct flash_dev *dev);
+
+int flash_register_device(struct flash_dev *dev)
+{
+	static bool made_default = false;
+	bool make_default = false;
+	int cpu, id, ret = 0;
+
+	if (cpumask_empty(&dev->cpus))
+		cpumask_copy(&dev->cpus, cpu_possible_mask);
+
+	mutex_lock(&flash_devs_mutex);
+
+	for (id = 0; id < FLASH_MAX_DEVS && flash_devs[id]; id++)
+		;
+	if (id == FLASH_MAX_DEVS) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	for_each_cpu(cpu, &dev->cpus) {
+		if (rcu_access_pointer(cpu_rq(cpu)->flash.dev)) {
+			ret = -EBUSY;
+			goto out;
+		}
+	}
+
+	dev->id = id;
+	rcu_assign_pointer(flash_devs[id], dev);
+	flash_bind_cpus(dev, dev);
+	flash_resync_device(dev);
+
+	if (flash_default_policy && !made_default)
+		made_default = make_default = true;
+out:
+	mutex_unlock(&flash_devs_mutex);
+
+	if (make_default)
+		sched_flash_make_default();
+
+	return ret;
+}
+EXPORT_SYMBOL(flash_register_device);
+
+void flash_unregister_device(struct flash_dev *dev)
+{
+	mutex_lock(&flash_devs_mutex);
+	if (dev->id < FLASH_MAX_DEVS &&
+	    rcu_access_pointer(flash_devs[dev->id]) == dev) {
+		flash_bind_cpus(dev, NULL);
+		rcu_assign_pointer(flash_devs[dev->id], NULL);
+		synchronize_sched();
+	}
+	mutex_unlock(&flash_devs_mutex);
+}
+EXPORT_SYMBOL(flash_unregister_device);
+
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+#define TASK_UNINTERRUPTIBLE	2
+#define __TASK_STOPPED		4
+#define __TASK_TRACED		8
+/* in tsk->exit_state */
+#define EXIT_ZOMBIE		16
+#define EXIT_DEAD		32
+/* in tsk->state again */
+#define TASK_DEAD		64
+#define TASK_WAKEKILL		128
+#define TASK_WAKING		256
+#define TASK_PARKED		512
+#define TASK_STATE_MAX		1024
+
+/*
+
+Transaction recorder. With tracing enabled (debugfs flash/trace_enable),
+every message to the device and every answer from it is appended as a
+struct flash_trace_record to a per-CPU relay buffer, read from
+debugfs flash/trace0, trace1, ... The buffers are written lock-free by
+the CPU that talks to the device; with tracing off the cost is a test of
+flash_trace_enabled.
+
+*/
+
+#if defined(CONFIG_RELAY) && defined(CONFIG_DEBUG_FS)
+
+static u32 flash_trace_enabled __read_mostly;
+static struct rchan *flash_trace_chan;
+
+static inline u64 flash_trace_start(void)
+{
+	return flash_trace_enabled ? local_clock() : 0;
+}
+
+static void flash_trace(struct flash_dev *dev, u8 kind, flash_arg_t *farg,
+			u16 ret, u64 start)
+{
+	struct flash_trace_record rec;
+	u64 now;
+
+	if (!start || !flash_trace_chan)
+		return;
+
+	now = local_clock();
+	rec.ts		= start;
+	rec.latency	= min_t(u64, now - start, U32_MAX);
+	rec.data	= farg->data;
+	rec.pid		= farg->pid;
+	rec.ret		= ret;
+	rec.state	= farg->state;
+	rec.gid		= farg->gid;
+	rec.cpu		= raw_smp_processor_id();
+	rec.kind	= kind;
+	rec.type	= farg->type;
+	rec.pri		= farg->pri;
+	rec.dev		= dev->id;
+	rec.version	= FLASH_TRACE_VERSION;
+	memset(rec.__pad, 0, sizeof(rec.__pad));
+
+	relay_write(flash_trace_chan, &rec, sizeof(rec));
+}
+
+static struct dentry *flash_trace_create_buf_file(const char *filename,
+		struct dentry *parent, umode_t mode,
+		struct rchan_buf *buf, int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf,
+				   &relay_file_operations);
+}
+
+static int flash_trace_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+
+static struct rchan_callbacks flash_trace_callbacks = {
+	.create_buf_file	= flash_trace_create_buf_file,
+	.remove_buf_file	= flash_trace_remove_buf_file,
+};
+
+#define FLASH_TRACE_SUBBUF_SIZE	(64 * 1024)
+#define FLASH_TRACE_NR_SUBBUFS	8
+
+static int __init flash_trace_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("flash", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	flash_trace_chan = relay_open("trace", dir, FLASH_TRACE_SUBBUF_SIZE,
+				      FLASH_TRACE_NR_SUBBUFS,
+				      &flash_trace_callbacks, NULL);
+	if (!flash_trace_chan) {
+		debugfs_remove(dir);
+		return -ENOMEM;
+	}
+
+	debugfs_create_bool("trace_enable", 0644, dir, &flash_trace_enabled);
+	return 0;
+}
+late_initcall(flash_trace_init);
+
+#else
+
+static inline u64 flash_trace_start(void)
+{
+	return 0;
+}
+
+static inline void flash_trace(struct flash_dev *dev, u8 kind,
+			       flash_arg_t *farg, u16 ret, u64 start)
+{
+}
+
+#endif /* CONFIG_RELAY && CONFIG_DEBUG_FS */
+
+/*
+
+Every message to and from a device goes through these two, so that the
+recorder sees all of them. flash_write_change() returns whether there was a
+device to send to; flash_write_sched() returns the PID the device picked, 0
+without a device.
+
+*/
+
+static bool flash_write_change(struct flash_dev *dev, flash_arg_t farg)
+{
+	u64 start;
+
+	if (!dev)
+		return false;
+
+	start = flash_trace_start();
+	dev->change_write_to_flash(dev, farg);
+	flash_trace(dev, FLASH_TRACE_CHANGE, &farg, 0, start);
+
+	return true;
+}
+
+static u16 flash_write_sched(struct flash_dev *dev, flash_arg_t farg)
+{
+	u64 start;
+	u16 pid;
+
+	if (!dev)
+		return 0;
+
+	start = flash_trace_start();
+	pid = dev->sched_write_to_flash(dev, farg);
+	flash_trace(dev, FLASH_TRACE_SCHED, &farg, pid, start);
+
+	return pid;
+}
+
+/* Messages that are not about one CPU's tasks go to every device */
+static void flash_write_all(flash_arg_t farg)
+{
+	int id;
+
+	rcu_read_lock_sched();
+	for (id = 0; id < FLASH_MAX_DEVS; id++)
+		flash_write_change(rcu_dereference_sched(flash_devs[id]), farg);
+	rcu_read_unlock_sched();
+}
+
+static void flash_op_write(struct flash_dev *dev, int op, u32 data)
+{
+	flash_arg_t farg = {
+		.type	= FLASH_OP(op) | FLASH_CHANGE_DATA,
+		.data	= data,
+	};
+
+	flash_write_change(dev, farg);
+}
+
+static inline u16 flash_task_gid(struct task_struct *p)
+{
+#ifdef CONFIG_CGROUP_SCHED
+	return task_group(p)->flash_gid;
+#else
+	return 0;
+#endif
+}
+
+/*
+
+The device serves lower pri values first, over 256 levels. A task's FLASH
+priority (sched_priority 0..MAX_USER_FLASH_PRIO-1, kept in rt_priority) picks
+the top FLASH_PRI_SHIFT-bit band, most important lowest, and its nice value
+orders tasks within the band in four steps, so latency-critical threads
+outrank batch threads whatever their nice values. PI boosting does not show:
+p->prio is an RT priority then and the device has no level for it.
+
+*/
+
+#define FLASH_PRI_SHIFT		2
+
+static inline u8 flash_task_pri(struct task_struct *p)
+{
+	int nice = p->static_prio - MAX_RT_PRIO;	/* 0..39 */
+
+	return (MAX_USER_FLASH_PRIO - 1 - p->rt_priority) << FLASH_PRI_SHIFT |
+	       nice * (1 << FLASH_PRI_SHIFT) / 40;
+}
+
+/*
+
+Send a change request about p to the device. The device only knows a task
+through these messages, so every attribute it tracks is sent each time.
+
+*/
+
+/*
+ * p->flash.registered and p->flash.dev_tag name a device this way, 0 for
+ * none.
+ */
+static inline unsigned char flash_dev_tag(struct flash_dev *dev)
+{
+	return dev ? dev->id + 1 : 0;
+}
+
+/*
+
+Per-task attributes (sched_flash_setattr()). A device that sets FLASH_DEV_ATTR
+hears a task's weight, latency class and slice in a FLASH_OP_ATTR message when
+they change, and when it learns of a task (FLASH_CHANGE_NEW, fork) that has
+any set, so it can share a priority level by weight and order waiters by
+latency class instead of keeping one undifferentiated queue.
+
+*/
+
+static inline bool flash_task_has_attr(struct task_struct *p)
+{
+	return p->flash.weight || p->flash.latency || p->flash.slice_us;
+}
+
+static void flash_attr_write(struct flash_dev *dev, struct task_struct *p)
+{
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_ATTR) | FLASH_CHANGE_DATA,
+		.pid	= p->pid,
+		.pri	= p->flash.latency,
+		.state	= p->flash.weight,
+		.data	= p->flash.slice_us,
+	};
+
+	if (!dev || !(dev->flags & FLASH_DEV_ATTR))
+		return;
+
+	flash_write_change(dev, farg);
+}
+
+/*
+
+Gangs. The threads of a thread group that set SCHED_FLASH_FLAG_GANG, such as
+the workers of a bulk-synchronous job that meet at barriers, form a gang
+named by the tgid. A device that sets FLASH_DEV_GANG co-schedules a gang from
+its decisions: picking one member for a CPU, it posts the others to the
+CPUs they are queued on as decision interrupts (flash_post_decision()), so
+no member spins at a barrier waiting for one that is not running. The class
+itself only places and picks as it would; co-scheduling is the device's.
+
+*/
+
+static void flash_gang_write(struct flash_dev *dev, struct task_struct *p)
+{
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_GANG) | FLASH_CHANGE_DATA,
+		.pid	= p->pid,
+		.data	= p->flash.gang ? p->tgid : 0,
+	};
+
+	if (!dev || !(dev->flags & FLASH_DEV_GANG))
+		return;
+
+	flash_write_change(dev, farg);
+}
+
+/*
+ * Called with p's rq->lock held by sched_flash_setattr(), and by
+ * switched_to_flash() for attributes set while p was out of the class.
+ */
+void flash_attr_changed(struct task_struct *p)
+{
+	struct flash_dev *dev = flash_cpu_dev(task_cpu(p));
+
+	p->flash.attr_stale = 0;
+	flash_attr_write(dev, p);
+	flash_gang_write(dev, p);
+}
+
+/* p's EDF deadline, or that it has none any more; see flash_edf_admit() */
+static void flash_deadline_write(struct flash_dev *dev, struct task_struct *p)
+{
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_DEADLINE) | FLASH_CHANGE_DATA,
+		.pid	= p->pid,
+		.state	= !!p->flash.dl_bw,
+		.data	= (u32)div_u64(p->flash.deadline, NSEC_PER_USEC),
+	};
+
+	if (!dev || !(dev->flags & FLASH_DEV_DEADLINE))
+		return;
+
+	flash_write_change(dev, farg);
+}
+
+static void __flash_change(struct flash_dev *dev, struct task_struct *p,
+			   u8 type, u16 state)
+{
+	flash_arg_t farg = {
+		.type	= type,
+		.pid	= p->pid,
+		.pri	= flash_task_pri(p),
+		.state	= state,
+		.gid	= flash_task_gid(p),
+	};
+
+	/*
+	 * Making it runnable also tells the device which CPU's queue it is
+	 * on, unless the device already has it there from last time.
+	 */
+	if (dev && (type & FLASH_CHANGE_STATE) && state != TASK_DEAD &&
+	    (p->flash.dev_tag != flash_dev_tag(dev) ||
+	     p->flash.dev_cpu != task_cpu(p))) {
+		farg.type |= FLASH_CHANGE_DATA;
+		farg.data = task_cpu(p);
+		p->flash.dev_tag = flash_dev_tag(dev);
+		p->flash.dev_cpu = task_cpu(p);
+	}
+
+	flash_write_change(dev, farg);
+	if ((type & __FLASH_CHANGE_NEW) && flash_task_has_attr(p))
+		flash_attr_write(dev, p);
+	if ((type & __FLASH_CHANGE_NEW) && p->flash.gang)
+		flash_gang_write(dev, p);
+	if (p->flash.dl_bw && (type & FLASH_CHANGE_STATE) && state != TASK_DEAD)
+		flash_deadline_write(dev, p);
+}
+
+/* Messages about p go to the device that owns p's CPU */
+static void flash_change(struct task_struct *p, u8 type, u16 state)
+{
+	__flash_change(flash_cpu_dev(task_cpu(p)), p, type, state);
+}
+
+/*
+
+Ask the device for the next task for rq's CPU. A device that interrupts with
+its decisions has usually posted one already (flash_post_decision()), and
+that is used without a round trip. The device may still name a task that has
+since blocked or moved to another CPU, so an answer is only used if that task
+is queued here; NULL otherwise. The device holds global PIDs, so they are
+looked up in the initial namespace, not that of whatever task is current.
+
+*/
+
+static struct task_struct *flash_task_on(struct rq *rq, u16 pid)
+{
+	struct task_struct *p;
+
+	if (!pid)
+		return NULL;
+
+	p = find_task_by_pid_ns(pid, &init_pid_ns);
+	if (!p || p->sched_class != &flash_sched_class || !p->on_rq ||
+	    task_cpu(p) != cpu_of(rq))
+		return NULL;
+
+	return p;
+}
+
+static struct task_struct *flash_sched(struct rq *rq)
+{
+	flash_arg_t farg = {
+		.data	= cpu_of(rq),
+	};
+	struct task_struct *p;
+
+	p = flash_task_on(rq, xchg(&rq->flash.next_pid, 0));
+	if (p)
+		return p;
+
+	return flash_task_on(rq, flash_write_sched(flash_cpu_dev(cpu_of(rq)),
+						   farg));
+}
+
+/*
+
+Decision interrupts. A device driver calls this from the interrupt raised
+for cpu with the PID the device wants to run there next. The decision waits
+in the CPU's slot for the next pick, which the resched raised here brings
+forward; a later decision replaces an unused earlier one.
+
+*/
+
+void flash_post_decision(int cpu, u16 pid)
+{
+	struct rq *rq = cpu_rq(cpu);
+
+	xchg(&rq->flash.next_pid, pid);
+
+	if (cpu != smp_processor_id())
+		resched_cpu(cpu);
+	else if (current->pid != pid)
+		set_tsk_need_resched(current);
+}
+EXPORT_SYMBOL(flash_post_decision);
+
+/*
+
+FLASH bandwidth. FLASH sits above CFS in the class chain, so a FLASH task that
+never blocks would starve everything below it. As with RT throttling, each
+runqueue may spend sched_flash_runtime_us of every sched_flash_period_us
+running FLASH tasks. Once that is used up the class stops picking on that CPU
+and the device is told not to schedule onto it, until the period timer hands
+out fresh runtime.
+
+*/
+
+unsigned int sysctl_sched_flash_period = 1000000;
+int sysctl_sched_flash_runtime = 950000;
+
+int sysctl_sched_flash_reset_on_fork = FLASH_RESET_KEEP;
+
+struct flash_bandwidth def_flash_bandwidth;
+
+static void flash_throttle_write(int cpu, int throttled)
+{
+	flash_op_write(flash_cpu_dev(cpu),
+		       throttled ? FLASH_OP_THROTTLE : FLASH_OP_UNTHROTTLE, cpu);
+}
+
+static int do_sched_flash_period_timer(struct flash_bandwidth *flash_b,
+				       int overrun)
+{
+	u64 runtime = flash_b->flash_runtime;
+	int i, idle = 1, throttled = 0;
+
+	for_each_online_cpu(i) {
+		struct rq *rq = cpu_rq(i);
+		struct flash_rq *flash_rq = &rq->flash;
+
+		raw_spin_lock(&rq->lock);
+		if (flash_rq->flash_time) {
+			if (runtime == RUNTIME_INF)
+				flash_rq->flash_time = 0;
+			else
+				flash_rq->flash_time -= min(flash_rq->flash_time,
+							    overrun * runtime);
+
+			if (flash_rq->flash_throttled &&
+			    flash_rq->flash_time < runtime) {
+				flash_rq->flash_throttled = 0;
+				flash_throttle_write(i, 0);
+				if (flash_rq->nr_running)
+					resched_task(rq->curr);
+			}
+			if (flash_rq->flash_time || flash_rq->nr_running)
+				idle = 0;
+		} else if (flash_rq->nr_running) {
+			idle = 0;
+		}
+		if (flash_rq->flash_throttled)
+			throttled = 1;
+		raw_spin_unlock(&rq->lock);
+	}
+
+	if (!throttled && (!flash_bandwidth_enabled() || runtime == RUNTIME_INF))
+		return 1;
+
+	return idle;
+}
+
+static enum hrtimer_restart sched_flash_period_timer(struct hrtimer *timer)
+{
+	struct flash_bandwidth *flash_b =
+		container_of(timer, struct flash_bandwidth, flash_period_timer);
+	ktime_t now;
+	int overrun;
+	int idle = 0;
+
+	for (;;) {
+		now = hrtimer_cb_get_time(timer);
+		overrun = hrtimer_forward(timer, now, flash_b->flash_period);
+
+		if (!overrun)
+			break;
+
+		idle = do_sched_flash_period_timer(flash_b, overrun);
+	}
+
+	return idle ? HRTIMER_NORESTART : HRTIMER_RESTART;
+}
+
+void init_flash_bandwidth(struct flash_bandwidth *flash_b, u64 period, u64 runtime)
+{
+	flash_b->flash_period = ns_to_ktime(period);
+	flash_b->flash_runtime = runtime;
+
+	raw_spin_lock_init(&flash_b->flash_runtime_lock);
+
+	hrtimer_init(&flash_b->flash_period_timer,
+			CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	flash_b->flash_period_timer.function = sched_flash_period_timer;
+}
+
+static void start_flash_bandwidth(struct flash_bandwidth *flash_b)
+{
+	if (!flash_bandwidth_enabled() || flash_b->flash_runtime == RUNTIME_INF)
+		return;
+
+	if (hrtimer_active(&flash_b->flash_period_timer))
+		return;
+
+	raw_spin_lock(&flash_b->flash_runtime_lock);
+	start_bandwidth_timer(&flash_b->flash_period_timer,
+			      flash_b->flash_period);
+	raw_spin_unlock(&flash_b->flash_runtime_lock);
+}
+
+static int sched_flash_runtime_exceeded(struct rq *rq)
+{
+	struct flash_rq *flash_rq = &rq->flash;
+	u64 runtime = def_flash_bandwidth.flash_runtime;
+
+	if (flash_rq->flash_throttled)
+		return 1;
+
+	if (runtime >= ktime_to_ns(def_flash_bandwidth.flash_period))
+		return 0;
+
+	if (flash_rq->flash_time > runtime) {
+		static bool once = false;
+
+		flash_rq->flash_throttled = 1;
+		flash_throttle_write(cpu_of(rq), 1);
+
+		if (!once) {
+			once = true;
+			printk_sched("sched: FLASH throttling activated\n");
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+
+Earliest deadline first. A FLASH task with EDF parameters (sched_flash_attr
+runtime_ns, deadline_ns and period_ns) is admitted only while the
+runtime/period shares of all of them fit the FLASH bandwidth of every online
+CPU; flash_edf_admit() checks this for sched_flash_setattr(),
+__sched_setscheduler() and the bulk switches, and flash_edf_cpu_busy() keeps
+a CPU from going offline under the admitted shares. The class then keeps
+each task's absolute deadline the way a constant bandwidth server does. A
+task that wakes up keeps its deadline if its leftover runtime still fits
+before it at the declared rate; otherwise it gets a fresh runtime and a
+deadline deadline_ns from now. A task that overruns its runtime has its
+deadline pushed back a period for every budget it uses, so it cannot make
+the others miss theirs. Deadlines follow each runnable message to the
+device, which picks by them (FLASH_DEV_DEADLINE); on a CPU whose device
+cannot, the class picks the earliest queued deadline itself.
+
+*/
+
+static DEFINE_RAW_SPINLOCK(flash_edf_lock);
+static unsigned long flash_edf_total;	/* admitted shares, under the lock */
+
+/* Share of one CPU that runtime every period is, 1 << 20 for all of it */
+unsigned long flash_edf_bw(u64 runtime, u64 period)
+{
+	if (!runtime || !period)
+		return 0;
+
+	return div64_u64(runtime << 20, period);
+}
+
+static unsigned long flash_edf_limit(int cpus)
+{
+	u64 runtime = global_flash_runtime();
+	unsigned long bw = runtime == RUNTIME_INF ? 1UL << 20 :
+			   flash_edf_bw(runtime, global_flash_period());
+
+	return bw * cpus;
+}
+
+/*
+ * CPU_DOWN_PREPARE: nothing takes admitted shares back, so a CPU may
+ * only go if the others can still carry them.
+ */
+bool flash_edf_cpu_busy(void)
+{
+	unsigned long flags;
+	bool busy;
+
+	raw_spin_lock_irqsave(&flash_edf_lock, flags);
+	busy = flash_edf_total > flash_edf_limit(num_online_cpus() - 1);
+	raw_spin_unlock_irqrestore(&flash_edf_lock, flags);
+
+	return busy;
+}
+
+/*
+ * Give p a share of bw, 0 to take it out of EDF; -EBUSY if that would
+ * overcommit the CPUs. p must not be on a FLASH runqueue, since
+ * flash_rq->nr_edf counts by p->flash.dl_bw.
+ */
+int flash_edf_admit(struct task_struct *p, unsigned long bw)
+{
+	unsigned long old = p->flash.dl_bw, flags;
+
+	raw_spin_lock_irqsave(&flash_edf_lock, flags);
+	if (bw > old &&
+	    flash_edf_total - old + bw > flash_edf_limit(num_online_cpus())) {
+		raw_spin_unlock_irqrestore(&flash_edf_lock, flags);
+		return -EBUSY;
+	}
+	flash_edf_total = flash_edf_total - old + bw;
+	raw_spin_unlock_irqrestore(&flash_edf_lock, flags);
+
+	p->flash.dl_bw = bw;
+	if (bw && !old) {
+		/* A deadline of 0 has passed: the next enqueue sets one */
+		p->flash.deadline = 0;
+		p->flash.runtime = 0;
+	} else if (!bw && old) {
+		rcu_read_lock_sched();
+		flash_deadline_write(flash_cpu_dev(task_cpu(p)), p);
+		rcu_read_unlock_sched();
+	}
+
+	return 0;
+}
+
+void flash_edf_release(struct task_struct *p)
+{
+	flash_edf_admit(p, 0);
+}
+
+/* Constant bandwidth server wakeup rule, at enqueue */
+static void flash_edf_wakeup(struct rq *rq, struct task_struct *p)
+{
+	struct sched_flash_entity *fse = &p->flash;
+	u64 now = rq->clock;
+
+	/*
+	 * runtime / (deadline - now) > dl_runtime / dl_period, in 1us units
+	 * so that the products fit 64 bits for periods up to
+	 * SCHED_FLASH_DL_PERIOD_MAX_NS.
+	 */
+	if ((s64)(fse->deadline - now) > 0 && fse->runtime > 0 &&
+	    (fse->runtime >> 10) * (fse->dl_period >> 10) <=
+	    ((fse->deadline - now) >> 10) * (fse->dl_runtime >> 10))
+		return;
+
+	fse->deadline = now + fse->dl_deadline;
+	fse->runtime = fse->dl_runtime;
+}
+
+static void flash_edf_charge(struct rq *rq, struct task_struct *p, u64 delta)
+{
+	struct sched_flash_entity *fse = &p->flash;
+
+	fse->runtime -= delta;
+	if (fse->runtime > 0)
+		return;
+
+	while (fse->runtime <= 0) {
+		fse->deadline += fse->dl_period;
+		fse->runtime += fse->dl_runtime;
+	}
+	flash_deadline_write(flash_cpu_dev(cpu_of(rq)), p);
+	if (rq->flash.nr_running > 1)
+		resched_task(p);
+}
+
+/*
+ * Update the current task's runtime statistics. Skip current tasks that
+ * are not in our scheduling class.
+ */
+static void update_curr_flash(struct rq *rq)
+{
+	struct task_struct *curr = rq->curr;
+	u64 delta_exec;
+
+	if (curr->sched_class != &flash_sched_class)
+		return;
+
+	delta_exec = rq->clock_task - curr->se.exec_start;
+	if (unlikely((s64)delta_exec <= 0))
+		return;
+
+	schedstat_set(curr->se.statistics.exec_max,
+		      max(curr->se.statistics.exec_max, delta_exec));
+
+	curr->se.sum_exec_runtime += delta_exec;
+	account_group_exec_runtime(curr, delta_exec);
+
+	curr->se.exec_start = rq->clock_task;
+	cpuacct_charge(curr, delta_exec);
+
+	/* CFS sees the CPU time FLASH took, as it does for RT */
+	sched_rt_avg_update(rq, delta_exec);
+
+	if (curr->flash.dl_bw)
+		flash_edf_charge(rq, curr, delta_exec);
+
+	if (!flash_bandwidth_enabled() ||
+	    def_flash_bandwidth.flash_runtime == RUNTIME_INF)
+		return;
+
+	rq->flash.flash_time += delta_exec;
+	if (sched_flash_runtime_exceeded(rq))
+		resched_task(curr);
+}
+
+/*
+
+Devices that set FLASH_DEV_RUNTIME are told how long each task ran every time
+it leaves the CPU, so that they can weigh their decisions by CPU time used.
+The run started when the task was picked (se.prev_sum_exec_runtime, as CFS).
+
+*/
+
+static void flash_runtime_write(struct rq *rq, struct task_struct *p)
+{
+	struct flash_dev *dev = flash_cpu_dev(cpu_of(rq));
+	u64 ran = p->se.sum_exec_runtime - p->se.prev_sum_exec_runtime;
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_RUNTIME) | FLASH_CHANGE_DATA,
+		.pid	= p->pid,
+		.data	= min_t(u64, div_u64(ran, NSEC_PER_USEC), U32_MAX),
+	};
+
+	if (!dev || !(dev->flags & FLASH_DEV_RUNTIME) || !ran)
+		return;
+
+	flash_write_change(dev, farg);
+}
+
+#ifdef CONFIG_SYSCTL
+static int sched_flash_global_constraints(void)
+{
+	int ret = 0;
+
+	if (!sysctl_sched_flash_period)
+		return -EINVAL;
+
+	if (sysctl_sched_flash_runtime >= 0 &&
+	    sysctl_sched_flash_runtime > sysctl_sched_flash_period)
+		return -EINVAL;
+
+	/* Not below what EDF tasks have been promised */
+	raw_spin_lock_irq(&flash_edf_lock);
+	if (flash_edf_total > flash_edf_limit(num_online_cpus()))
+		ret = -EBUSY;
+	raw_spin_unlock_irq(&flash_edf_lock);
+
+	return ret;
+}
+
+static int sched_flash_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp,
+		loff_t *ppos)
+{
+	int ret;
+	unsigned int old_period;
+	int old_runtime;
+	static DEFINE_MUTEX(mutex);
+
+	mutex_lock(&mutex);
+	old_period = sysctl_sched_flash_period;
+	old_runtime = sysctl_sched_flash_runtime;
+
+	ret = proc_dointvec(table, write, buffer, lenp, ppos);
+
+	if (!ret && write) {
+		ret = sched_flash_global_constraints();
+		if (ret) {
+			sysctl_sched_flash_period = old_period;
+			sysctl_sched_flash_runtime = old_runtime;
+		} else {
+			struct flash_bandwidth *flash_b = &def_flash_bandwidth;
+			unsigned long flags;
+
+			raw_spin_lock_irqsave(&flash_b->flash_runtime_lock, flags);
+			flash_b->flash_runtime = global_flash_runtime();
+			flash_b->flash_period = ns_to_ktime(global_flash_period());
+			raw_spin_unlock_irqrestore(&flash_b->flash_runtime_lock,
+						   flags);
+		}
+	}
+	mutex_unlock(&mutex);
+
+	return ret;
+}
+
+static int flash_reset_min = FLASH_RESET_KEEP;
+static int flash_reset_max = FLASH_RESET_TO_NORMAL;
+
+static struct ctl_table sched_flash_sysctls[] = {
+	{
+		.procname	= "sched_flash_period_us",
+		.data		= &sysctl_sched_flash_period,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= sched_flash_handler,
+	},
+	{
+		.procname	= "sched_flash_runtime_us",
+		.data		= &sysctl_sched_flash_runtime,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= sched_flash_handler,
+	},
+	{
+		.procname	= "sched_flash_reset_on_fork",
+		.data		= &sysctl_sched_flash_reset_on_fork,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &flash_reset_min,
+		.extra2		= &flash_reset_max,
+	},
+	{ }
+};
+
+static int __init sched_flash_sysctl_init(void)
+{
+	register_sysctl("kernel", sched_flash_sysctls);
+	return 0;
+}
+late_initcall(sched_flash_sysctl_init);
+#endif /* CONFIG_SYSCTL */
+
+/*
+
+FLASH tasks count towards rq->nr_running and rq->load like CFS entities do, by
+their nice weight. Otherwise nr_running(), the idle and nohz checks, cpu_load[]
+and the CFS load balancer would see a CPU full of FLASH work as idle, and
+pick_next_task() would take its all-CFS shortcut straight past this class.
+
+*/
+
+static inline void inc_flash_tasks(struct rq *rq, struct task_struct *p)
+{
+	rq->flash.nr_running++;
+	inc_nr_running(rq);
+	update_load_add(&rq->load, p->se.load.weight);
+}
+
+static inline void dec_flash_tasks(struct rq *rq, struct task_struct *p)
+{
+	rq->flash.nr_running--;
+	dec_nr_running(rq);
+	update_load_sub(&rq->load, p->se.load.weight);
+}
+
+/*
+
+FLASH load tracking. Each task keeps a decayed average of how much of the
+time it was runnable, scaled to FLASH_UTIL_SCALE, in the manner of CFS's
+per-entity load tracking: time is cut into ~1ms periods and a period's
+contribution halves every 32 periods. A task blocked for a while has decayed
+by the time it wakes up, and a 1% poller ends up near 10 where a busy thread
+is near 1024. flash_rq->util_sum is the sum over the tasks queued on the CPU
+and is what select_task_rq_flash() and hotplug migration balance on.
+
+To keep this O(1), a queued task's average is only brought up to date when it
+is enqueued, dequeued or ticked as current; the sum always holds exactly the
+values of the queued tasks.
+
+*/
+
+#define FLASH_UTIL_PERIOD_SHIFT	20	/* ~1ms periods of rq->clock */
+
+static const u32 flash_util_y_inv[32] = {
+	0xffffffff, 0xfa83b2db, 0xf5257d15, 0xefe4b99b, 0xeac0c6e7, 0xe5b906e7,
+	0xe0ccdeec, 0xdbfbb797, 0xd744fcca, 0xd2a81d91, 0xce248c15, 0xc9b9bd86,
+	0xc5672a11, 0xc12c4cca, 0xbd08a39f, 0xb8fbaf47, 0xb504f333, 0xb123f581,
+	0xad583eea, 0xa9a15ab4, 0xa5fed6a9, 0xa2704303, 0x9ef53260, 0x9b8d39b9,
+	0x9837f051, 0x94f4efa8, 0x91c3d373, 0x8ea4398b, 0x8b95c1e3, 0x88980e80,
+	0x85aac367, 0x82cd8698,
+};
+
+/* val * y^n, with y^32 = 1/2 */
+static u32 flash_util_decay(u32 val, u64 n)
+{
+	if (n >= 32 * 32)
+		return 0;
+
+	val >>= n / 32;
+	return (u32)(((u64)val * flash_util_y_inv[n % 32]) >> 32);
+}
+
+/*
+ * Bring p's average up to rq's clock, counting the elapsed periods as
+ * runnable or not, and keep util_sum in step if p is queued there.
+ */
+static void flash_update_util(struct rq *rq, struct task_struct *p,
+			      int runnable, int queued)
+{
+	struct sched_flash_entity *fse = &p->flash;
+	u64 now = rq->clock, periods;
+	u32 old = fse->util_avg;
+
+	if (!fse->util_stamp || (s64)(now - fse->util_stamp) < 0) {
+		fse->util_stamp = now;
+		return;
+	}
+
+	periods = (now - fse->util_stamp) >> FLASH_UTIL_PERIOD_SHIFT;
+	if (!periods)
+		return;
+	fse->util_stamp += periods << FLASH_UTIL_PERIOD_SHIFT;
+
+	fse->util_avg = flash_util_decay(old, periods);
+	if (runnable)
+		fse->util_avg += FLASH_UTIL_SCALE -
+				 flash_util_decay(FLASH_UTIL_SCALE, periods);
+
+	if (queued) {
+		rq->flash.util_sum -= old;
+		rq->flash.util_sum += fse->util_avg;
+	}
+}
+
+#ifdef CONFIG_SMP
+
+/*
+
+Per-node FLASH load. Placement compares NUMA nodes by the FLASH load queued on
+their CPUs without walking every runqueue: each CPU folds the change in its
+util_sum into its node's flash_node_util once it has drifted by a quarter of a
+busy task, when its last task leaves and on every FLASH tick, so the summary
+is never more than that per CPU off and costs one atomic now and then.
+
+*/
+
+#define FLASH_NODE_PUBLISH	(FLASH_UTIL_SCALE / 4)
+
+static atomic_long_t flash_node_util[MAX_NUMNODES];
+
+static void flash_node_publish(struct rq *rq, int force)
+{
+	long delta = (long)(rq->flash.util_sum - rq->flash.util_node);
+
+	if (!delta || (!force && delta < FLASH_NODE_PUBLISH &&
+		       -delta < FLASH_NODE_PUBLISH))
+		return;
+
+	atomic_long_add(delta, &flash_node_util[cpu_to_node(cpu_of(rq))]);
+	rq->flash.util_node = rq->flash.util_sum;
+}
+
+/* Average FLASH load of the node's CPUs */
+static unsigned long flash_node_load(int nid)
+{
+	unsigned int weight = cpumask_weight(cpumask_of_node(nid));
+	long util = atomic_long_read(&flash_node_util[nid]);
+
+	if (!weight)
+		return ULONG_MAX;
+	return util > 0 ? util / weight : 0;
+}
+
+#else
+
+static inline void flash_node_publish(struct rq *rq, int force)
+{
+}
 
-#define FLASH_CHANGE_PRI       (1 << 0)
-#define FLASH_CHANGE_STATE     (1 << 1)
-#define __FLASH_CHANGE_NEW     (1 << 2)
-#define FLASH_CHANGE_NEW       (__FLASH_CHANGE_NEW | \
-		                            FLASH_CHANGE_PRI | \
-		                            FLASH_CHANGE_STATE)
+#endif /* CONFIG_SMP */
 
-#define TASK_RUNNING		0
-#define TASK_INTERRUPTIBLE	1
-#define TASK_UNINTERRUPTIBLE	2
-#define __TASK_STOPPED		4
-#define __TASK_TRACED		8
-/* in tsk->exit_state */
-#define EXIT_ZOMBIE		16
-#define EXIT_DEAD		32
-/* in tsk->state again */
-#define TASK_DEAD		64
-#define TASK_WAKEKILL		128
-#define TASK_WAKING		256
-#define TASK_PARKED		512
-#define TASK_STATE_MAX		1024
+/*
+
+A device that sets FLASH_DEV_UTIL hears a task's average every time it is
+queued, as a hint for its own placement.
+
+*/
+
+static void flash_util_write(struct rq *rq, struct task_struct *p)
+{
+	struct flash_dev *dev = flash_cpu_dev(cpu_of(rq));
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_UTIL) | FLASH_CHANGE_DATA,
+		.pid	= p->pid,
+		.data	= p->flash.util_avg,
+	};
+
+	if (!dev || !(dev->flags & FLASH_DEV_UTIL))
+		return;
+
+	flash_write_change(dev, farg);
+}
 
 /*
 
@@ -43,16 +1145,47 @@ static void
 enqueue_task_flash(struct rq *rq, struct task_struct *p, int flags)
 {
 	struct flash_rq *flash_rq = &rq->flash;
-	flash_arg_t farg;
 
-	flash_rq->nr_running++;
+	list_add_tail(&p->flash.list, &flash_rq->queue);
+	inc_flash_tasks(rq, p);
 
-	farg.type = FLASH_CHANGE_NEW;
-	farg.pid = p->pid;
-	farg.pri = p->prio;
-	farg.state = p->state;
+	/* Decay over the time it was blocked before it counts here */
+	flash_update_util(rq, p, 0, 0);
+	flash_rq->util_sum += p->flash.util_avg;
+	flash_node_publish(rq, 0);
 
-	flash->change_write_to_flash(flash, farg);
+	/* First-touch: its memory is wherever it first runs */
+	if (p->flash.numa_node == NUMA_NO_NODE)
+		p->flash.numa_node = cpu_to_node(cpu_of(rq));
+
+	if (p->flash.dl_bw) {
+		flash_rq->nr_edf++;
+		flash_edf_wakeup(rq, p);
+	}
+
+	/*
+	 * A child registered at fork already has its slot, unless the wakeup
+	 * placed it on another device's CPU: then that slot is given back
+	 * and the local device learns of it as a new task.
+	 */
+	if (p->flash.batched) {
+		/* flash_batch_task() will tell the device */
+	} else if (p->flash.registered &&
+		   p->flash.registered == flash_dev_tag(flash_cpu_dev(cpu_of(rq)))) {
+		p->flash.registered = 0;
+		flash_change(p, FLASH_CHANGE_STATE, p->state);
+	} else {
+		unsigned char tag = p->flash.registered;
+
+		if (tag)
+			__flash_change(rcu_dereference_sched(flash_devs[tag - 1]),
+				       p, FLASH_CHANGE_STATE, TASK_DEAD);
+		p->flash.registered = 0;
+		flash_change(p, FLASH_CHANGE_NEW, p->state);
+	}
+	if (!p->flash.batched)
+		flash_util_write(rq, p);
+	start_flash_bandwidth(&def_flash_bandwidth);
 
 	printk("enqueue_task_flash: %u\n", p->pid);
 
@@ -79,17 +1212,19 @@ the task is done running NOT when its timeslice has expired.
 static void
 dequeue_task_flash(struct rq *rq, struct task_struct *p, int flags)
 {
-	struct flash_rq *flash_rq = &rq->flash;
-	flash_arg_t farg;
+	update_curr_flash(rq);
 
-	flash_rq->nr_running--;
+	list_del_init(&p->flash.list);
+	dec_flash_tasks(rq, p);
 
-	farg.type = FLASH_CHANGE_STATE;
-	farg.pid = p->pid;
-	farg.pri = p->prio;
-	farg.state = TASK_DEAD;
-	
-	flash->change_write_to_flash(flash, farg);
+	flash_update_util(rq, p, 1, 1);
+	rq->flash.util_sum -= p->flash.util_avg;
+	flash_node_publish(rq, !rq->flash.nr_running);
+	if (p->flash.dl_bw)
+		rq->flash.nr_edf--;
+
+	if (!p->flash.batched)
+		flash_change(p, FLASH_CHANGE_STATE, TASK_DEAD);
 
 	printk("dequeue_task_flash: %u\n", p->pid);
 	
@@ -131,7 +1266,9 @@ yield_task_flash(struct rq *rq)
 
 /*
 
-Not needed since FLASH is not a preemptive scheduler.
+FLASH leaves preemption to the device at the next tick, except for EDF: a
+task woken with an earlier deadline than the running one, or with any
+deadline when the running one has none, preempts at once.
 
 */
 
@@ -139,8 +1276,48 @@ static void
 check_preempt_curr_flash(struct rq *rq,
 		struct task_struct *p, int flags)
 {
+	struct task_struct *curr = rq->curr;
+
 	printk("check_preempt_curr_flash\n");
-	// We know if we need to or not to preempt
+	if (p->flash.dl_bw &&
+	    (!curr->flash.dl_bw ||
+	     (s64)(p->flash.deadline - curr->flash.deadline) < 0))
+		resched_task(curr);
+}
+
+/* EDF tasks queued on a CPU whose device cannot pick by deadline */
+static inline bool flash_edf_local(struct rq *rq)
+{
+	struct flash_dev *dev;
+
+	if (!rq->flash.nr_edf)
+		return false;
+
+	dev = flash_cpu_dev(cpu_of(rq));
+	return !dev || !(dev->flags & FLASH_DEV_DEADLINE);
+}
+
+/* Earliest deadline queued on rq; a scan, but only of one CPU's queue */
+static struct task_struct *flash_edf_pick(struct rq *rq)
+{
+	struct task_struct *p, *best = NULL;
+
+	list_for_each_entry(p, &rq->flash.queue, flash.list) {
+		if (p->flash.dl_bw &&
+		    (!best ||
+		     (s64)(p->flash.deadline - best->flash.deadline) < 0))
+			best = p;
+	}
+
+	return best;
+}
+
+/* Ticks p runs when no device decides: its requested slice, if any */
+static inline unsigned int flash_task_slice(struct task_struct *p)
+{
+	if (!p->flash.slice_us)
+		return FLASH_TIMESLICE;
+	return max_t(unsigned int, usecs_to_jiffies(p->flash.slice_us), 1);
 }
 
 /*
@@ -156,22 +1333,27 @@ that needs to run.
 
 */
 
-
 static struct task_struct *pick_next_task_flash(struct rq *rq)
 {
 	struct flash_rq *flash_rq = &rq->flash;
 	struct task_struct *p;
-	flash_arg_t farg;
-	pid_t pid;
 
-	if (flash_rq->nr_running == 0)
+	if (flash_rq->nr_running == 0 || flash_rq->flash_throttled)
 		return NULL;
 
-	// Get PID
-	pid = flash->sched_write_to_flash(flash, farg);
-	p = find_task_by_vpid(pid);
-	// Lookup task struct from PID
-	// p = container_of(entity, struct task_struct, flash);
+	/*
+	 * If the device has nothing usable for this CPU, run the oldest task
+	 * queued here and rotate it to the tail so none of them starves.
+	 */
+	p = flash_edf_local(rq) ? flash_edf_pick(rq) : flash_sched(rq);
+	if (!p) {
+		p = list_first_entry(&flash_rq->queue, struct task_struct,
+				     flash.list);
+		list_move_tail(&p->flash.list, &flash_rq->queue);
+	}
+	p->se.exec_start = rq->clock_task;
+	p->se.prev_sum_exec_runtime = p->se.sum_exec_runtime;
+	p->flash.time_slice = flash_task_slice(p);
 	
 	printk("pick_next_task_flash\n");
 	return p;
@@ -188,6 +1370,8 @@ we do that in task_tick_flash() depending on the available timeslice.
 
 static void put_prev_task_flash(struct rq *rq, struct task_struct *prev)
 {
+	update_curr_flash(rq);
+	flash_runtime_write(rq, prev);
 	printk("put_prev_task_flash\n");
 	// Inform the device that this task is no longer on the runqueue?
 	// struct flash_rq *flash_rq = &rq->flash;
@@ -203,60 +1387,314 @@ static void put_prev_task_flash(struct rq *rq, struct task_struct *prev)
 	// flash->change_write_to_flash(flash, farg);
 }
 
+#ifdef CONFIG_SMP
+
 /*
 
-Helper function called by select_task_rq_flash()
+Helper function called by select_task_rq_flash(). Only CPUs in mask that are
+active and that p may run on are considered; returns -1 if there are none.
+CPUs are compared by the FLASH load queued on them (flash_rq->util_sum), so a
+CPU with a few light pollers still gets a new busy thread before one with a
+single busy thread does.
+
+Leaving the CPUs of p's current device costs a removal on that device and a
+registration on the other, so the least loaded CPU of the same device wins
+unless another device's CPU is lighter by a whole busy task.
 
 */
 
-static int find_min_rq_cpu(struct task_struct *p)
+#define FLASH_DEV_IMBALANCE	FLASH_UTIL_SCALE
+
+static int __find_min_rq_cpu(struct task_struct *p, const struct cpumask *mask,
+			     unsigned long *util)
 {
-	int cpu, min_cpu = 0, min_running = 0, first = 1;
+	int cpu, min_cpu = -1, local_cpu = -1;
+	unsigned long min_util = 0, local_util = 0;
+	struct flash_dev *dev = flash_cpu_dev(task_cpu(p));
 	struct rq *rq;
-	struct flash_rq *flash_rq;
 
-	for_each_possible_cpu(cpu) {
-	
-		rq = cpu_rq(cpu);
-		flash_rq = &rq->flash;
-	
-		if (first) {
-			min_running = rq->flash.nr_running;
-			min_cpu = cpu;
-			first = 0;
+	for_each_cpu_and(cpu, mask, tsk_cpus_allowed(p)) {
+		if (!cpu_active(cpu))
 			continue;
+
+		rq = cpu_rq(cpu);
+
+		if (rcu_access_pointer(rq->flash.dev) == dev &&
+		    (local_cpu < 0 || local_util > rq->flash.util_sum)) {
+			local_util = rq->flash.util_sum;
+			local_cpu = cpu;
 		}
 	
-		if (min_running > rq->flash.nr_running) {
-			min_running = rq->flash.nr_running;
+		if (min_cpu < 0 || min_util > rq->flash.util_sum) {
+			min_util = rq->flash.util_sum;
 			min_cpu = cpu;
 		}			
 	}
 
+	if (local_cpu >= 0 && local_util < min_util + FLASH_DEV_IMBALANCE) {
+		*util = local_util;
+		return local_cpu;
+	}
+
+	*util = min_util;
+	return min_cpu;
+}
+
+/*
+
+NUMA. A FLASH task's home node is where its memory is: the node it was first
+queued on (first-touch allocation), its parent's home for a fork child, which
+shares the parent's pages, and the node it is placed on at exec, which starts
+a new mm. Only the home node's CPUs are scanned while one of them has room for
+another busy task. Otherwise the per-node summaries (flash_node_load()) name
+the lightest node, and p goes there only if that node's lightest CPU beats the
+home node's by FLASH_NUMA_IMBALANCE, enough to be worth remote memory
+accesses. If p may not run on its home node at all, every CPU is considered.
+
+*/
+
+#define FLASH_NUMA_IMBALANCE	FLASH_UTIL_SCALE
+
+static int flash_numa_min_cpu(struct task_struct *p, int home,
+			      unsigned long home_util)
+{
+	unsigned long min_load = ULONG_MAX, util;
+	int nid, min_nid = NUMA_NO_NODE, cpu;
+
+	for_each_online_node(nid) {
+		unsigned long load;
+
+		if (nid == home)
+			continue;
+		load = flash_node_load(nid);
+		if (load < min_load) {
+			min_load = load;
+			min_nid = nid;
+		}
+	}
+
+	if (min_nid == NUMA_NO_NODE || min_load + FLASH_NUMA_IMBALANCE > home_util)
+		return -1;
+
+	cpu = __find_min_rq_cpu(p, cpumask_of_node(min_nid), &util);
+	if (cpu < 0 || util + FLASH_NUMA_IMBALANCE > home_util)
+		return -1;
+
+	return cpu;
+}
+
+static int find_min_rq_cpu(struct task_struct *p)
+{
+	int home = p->flash.numa_node, cpu, remote;
+	unsigned long util;
+
+	if (home != NUMA_NO_NODE && nr_node_ids > 1) {
+		cpu = __find_min_rq_cpu(p, cpumask_of_node(home), &util);
+		if (cpu >= 0 && util < FLASH_UTIL_SCALE)
+			return cpu;
+		if (cpu >= 0) {
+			remote = flash_numa_min_cpu(p, home, util);
+			return remote >= 0 ? remote : cpu;
+		}
+	}
+
+	cpu = __find_min_rq_cpu(p, cpu_active_mask, &util);
+	return cpu >= 0 ? cpu : task_cpu(p);
+}
+
+/*
+
+Least loaded CPU p may run on that shares a last-level cache with cpu, or -1.
+Called under rcu_read_lock() for sd_llc.
+
+*/
+
+static int flash_llc_min_cpu(struct task_struct *p, int cpu,
+			     unsigned long *util)
+{
+	struct sched_domain *sd = rcu_dereference(per_cpu(sd_llc, cpu));
+	int i, min_cpu = -1;
+
+	/* No cache domain above the CPU: it only shares with itself */
+	if (!sd) {
+		if (!cpu_active(cpu) || !cpumask_test_cpu(cpu, tsk_cpus_allowed(p)))
+			return -1;
+		*util = cpu_rq(cpu)->flash.util_sum;
+		return cpu;
+	}
+
+	for_each_cpu_and(i, sched_domain_span(sd), tsk_cpus_allowed(p)) {
+		if (!cpu_active(i))
+			continue;
+		if (min_cpu < 0 || cpu_rq(i)->flash.util_sum < *util) {
+			*util = cpu_rq(i)->flash.util_sum;
+			min_cpu = i;
+		}
+	}
+
 	return min_cpu;
 }
 
 /*
 
-When a new task has to be allotted to a rq, this function is called. Internally calls 
-find_min_rq_cpu since FLASH allots a new task to the runqueue that has the least number
-of tasks at a given moment
+When a new task has to be allotted to a rq, this function is called. New and
+exec'ing tasks go to the least loaded CPU (find_min_rq_cpu()). A waking task
+keeps its cache: it goes back to the CPU it last ran on unless that CPU is
+clearly busier than the rest of its last-level cache, in which case the
+lightest CPU of that cache, or of the waker's if the waker's is lighter and on
+the task's home node, takes it. Only when even that CPU has a busy task's
+worth of load, or the task was last run away from its home node, is the
+machine searched, home node first. A task that stays on its CPU also costs the
+device one word less, see __flash_change().
 
 */
 
+#define FLASH_LLC_IMBALANCE	(FLASH_UTIL_SCALE / 2)
+
 static int
 select_task_rq_flash(struct task_struct *p, int sd_flag, int flags)
 {
-	int min_cpu = 0;
-	min_cpu = find_min_rq_cpu(p);
+	int prev_cpu = task_cpu(p), this_cpu = smp_processor_id();
+	unsigned long llc_util = 0, util = 0;
+	int llc_cpu, cpu;
+
+	int home = p->flash.numa_node;
+
 	printk("select_task_rq_flash\n");
-	return min_cpu;
+
+	/* A new mm is allocated wherever exec places it */
+	if (sd_flag & SD_BALANCE_EXEC) {
+		p->flash.numa_node = NUMA_NO_NODE;
+		cpu = find_min_rq_cpu(p);
+		p->flash.numa_node = cpu_to_node(cpu);
+		return cpu;
+	}
+
+	if (!(sd_flag & SD_BALANCE_WAKE))
+		return find_min_rq_cpu(p);
+
+	/* Pulled off its memory earlier: see whether home has room again */
+	if (home != NUMA_NO_NODE && cpu_to_node(prev_cpu) != home)
+		return find_min_rq_cpu(p);
+
+	rcu_read_lock();
+	llc_cpu = flash_llc_min_cpu(p, prev_cpu, &llc_util);
+	if (!cpus_share_cache(this_cpu, prev_cpu) &&
+	    (home == NUMA_NO_NODE || cpu_to_node(this_cpu) == home)) {
+		cpu = flash_llc_min_cpu(p, this_cpu, &util);
+		if (cpu >= 0 &&
+		    (llc_cpu < 0 || util + FLASH_LLC_IMBALANCE < llc_util)) {
+			llc_cpu = cpu;
+			llc_util = util;
+		}
+	}
+	rcu_read_unlock();
+
+	if (llc_cpu < 0 || llc_util >= FLASH_UTIL_SCALE)
+		return find_min_rq_cpu(p);
+
+	if (cpu_active(prev_cpu) &&
+	    cpumask_test_cpu(prev_cpu, tsk_cpus_allowed(p)) &&
+	    cpu_rq(prev_cpu)->flash.util_sum <= llc_util + FLASH_LLC_IMBALANCE)
+		return prev_cpu;
+
+	return llc_cpu;
+}
+
+static void flash_cpu_write(int cpu, int op, u32 data)
+{
+	flash_op_write(flash_cpu_dev(cpu), op, data);
+}
+
+/*
+
+CPU hotplug. When a CPU goes down the device is first told to stop picking
+for it; migrate_tasks() then hands its FLASH tasks to the surviving CPUs
+(see move_queued_flash_tasks()). When it comes back the device may queue
+tasks on it again.
+
+*/
+
+static void rq_online_flash(struct rq *rq)
+{
+	flash_cpu_write(cpu_of(rq), FLASH_OP_CPU_ONLINE, cpu_of(rq));
+}
+
+static void rq_offline_flash(struct rq *rq)
+{
+	flash_cpu_write(cpu_of(rq), FLASH_OP_CPU_OFFLINE, cpu_of(rq));
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+
+/*
+
+Move every queued FLASH task of src_rq that may run on dst_rq's CPU over to
+dst_rq in one pass. The tasks stay queued, so when both CPUs belong to the
+same device it gets a single message moving the source CPU's queue instead
+of a dequeue and an enqueue message per task. Across devices each task has to
+be removed from one and registered with the other. Tasks that cannot run on
+the destination are left where they are. Both runqueues must be locked;
+returns the number of tasks moved.
+
+*/
+
+int move_queued_flash_tasks(struct rq *src_rq, struct rq *dst_rq)
+{
+	struct flash_dev *src_dev = flash_cpu_dev(cpu_of(src_rq));
+	struct flash_dev *dst_dev = flash_cpu_dev(cpu_of(dst_rq));
+	struct task_struct *p, *n;
+	int dst_cpu = cpu_of(dst_rq), moved = 0;
+
+	list_for_each_entry_safe(p, n, &src_rq->flash.queue, flash.list) {
+		if (p == src_rq->curr ||
+		    !cpumask_test_cpu(dst_cpu, tsk_cpus_allowed(p)))
+			continue;
+
+		list_move_tail(&p->flash.list, &dst_rq->flash.queue);
+		dec_flash_tasks(src_rq, p);
+		inc_flash_tasks(dst_rq, p);
+		src_rq->flash.util_sum -= p->flash.util_avg;
+		dst_rq->flash.util_sum += p->flash.util_avg;
+		if (p->flash.dl_bw) {
+			src_rq->flash.nr_edf--;
+			dst_rq->flash.nr_edf++;
+		}
+		if (src_dev != dst_dev)
+			__flash_change(src_dev, p, FLASH_CHANGE_STATE, TASK_DEAD);
+		set_task_cpu(p, dst_cpu);
+		if (src_dev != dst_dev)
+			__flash_change(dst_dev, p, FLASH_CHANGE_NEW, TASK_RUNNING);
+		else
+			p->flash.dev_cpu = dst_cpu;
+		moved++;
+	}
+
+	if (!moved)
+		return 0;
+
+	flash_node_publish(src_rq, 1);
+	flash_node_publish(dst_rq, 1);
+	if (src_dev == dst_dev)
+		flash_cpu_write(dst_cpu, FLASH_OP_CPU_MOVE,
+				cpu_of(src_rq) | dst_cpu << 16);
+	start_flash_bandwidth(&def_flash_bandwidth);
+	if (!rt_task(dst_rq->curr))
+		resched_task(dst_rq->curr);
+
+	return moved;
 }
 
+#endif /* CONFIG_HOTPLUG_CPU */
+
+#endif /* CONFIG_SMP */
+
 /*
 
 When a task sets its policy to FLASH, this function is called. At this point,
-the task's policy is already set so we just have to initialize the timeslice.
+the task's policy is already set. The running task is always on the runqueue
+as well, so enqueue_task_flash() has already counted it and registered it
+with the device; counting it here again would leak an nr_running.
 
 */
 
@@ -264,19 +1702,28 @@ the task's policy is already set so we just have to initialize the timeslice.
 static void
 set_curr_task_flash(struct rq *rq)
 {
-	struct flash_rq *flash_rq = &rq->flash;
-	struct task_struct *p = rq->curr;
-	flash_arg_t farg;
+	rq->curr->se.exec_start = rq->clock_task;
+	rq->curr->se.prev_sum_exec_runtime = rq->curr->se.sum_exec_runtime;
+	printk("set_curr_task_flash\n");
+}
 
-	flash_rq->nr_running++;
+/*
 
-	farg.type = FLASH_CHANGE_NEW;
-	farg.pid = p->pid;
-	farg.pri = p->prio;
-	farg.state = p->state;
+A CPU whose only runnable task is one FLASH task with no bandwidth limit has
+no decision to make: nothing can preempt it until something else is enqueued,
+and that enqueue brings the next tick's query back. This is the condition
+under which the tick itself could be stopped; without full dynticks the class
+at least leaves the device alone, sparing the MMIO round trip every jiffy.
 
-	flash->change_write_to_flash(flash, farg);
-	printk("set_curr_task_flash\n");
+*/
+
+static inline bool flash_tick_needed(struct rq *rq)
+{
+	if (rq->nr_running != 1 || rq->flash.nr_running != 1)
+		return true;
+
+	return flash_bandwidth_enabled() &&
+	       def_flash_bandwidth.flash_runtime != RUNTIME_INF;
 }
 
 /*
@@ -309,17 +1756,144 @@ static void task_tick_flash(struct rq *rq, struct task_struct *curr, int queued)
 	// 	resched_task(curr);
 	// }
 	struct task_struct *p;
-	flash_arg_t farg;
-	pid_t pid;
+	u32 next_pid;
+
+	/* Out of bandwidth: update_curr_flash() has already rescheduled */
+	update_curr_flash(rq);
+	flash_update_util(rq, curr, 1, 1);
+	flash_node_publish(rq, 1);
+	if (rq->flash.flash_throttled)
+		return;
+
+	/* EDF picked here: only an earlier deadline takes the CPU */
+	if (flash_edf_local(rq)) {
+		if (!curr->flash.dl_bw)
+			resched_task(curr);
+		return;
+	}
+
+	/* No device: round-robin the local queue, flash_task_slice() each */
+	if (!rcu_access_pointer(rq->flash.dev)) {
+		if (curr->flash.time_slice && --curr->flash.time_slice)
+			return;
+		curr->flash.time_slice = flash_task_slice(curr);
+		if (rq->flash.nr_running > 1)
+			resched_task(curr);
+		return;
+	}
+
+	/*
+	 * A posted decision waits for the next pick. Its resched may have
+	 * been lost to a contended resched_cpu(), so ask again; one naming
+	 * curr is already served and must not hold up later ticks.
+	 */
+	next_pid = ACCESS_ONCE(rq->flash.next_pid);
+	if (next_pid) {
+		if (next_pid != curr->pid)
+			resched_task(curr);
+		else
+			cmpxchg(&rq->flash.next_pid, next_pid, 0);
+		return;
+	}
+
+	if (!flash_tick_needed(rq))
+		return;
 
-	// Get PID
-	pid = flash->sched_write_to_flash(flash, farg);
-	p = find_task_by_vpid(pid);
-	if (p != curr)
+	/* Only give up the CPU for a task that can run here */
+	p = flash_sched(rq);
+	if (p && p != curr)
 		resched_task(curr);
 	printk("task_tick_flash\n");
 }
 
+/*
+
+Fork. sched_fork() calls this before the child has a PID, so all we can do
+here is remember whose device slot it should inherit: the parent's, if the
+parent is a FLASH task itself. A reset-on-fork child starts from scratch,
+since its parent's slot holds the attributes sched_fork() just cleared; the
+parent's flag says so, as the child's is gone by now. Once the PID exists,
+wake_up_new_task() calls flash_fork_register() outside the runqueue locks,
+the device allocates the child's slot there, and the first enqueue only has
+to mark it runnable.
+
+*/
+
+static void task_fork_flash(struct task_struct *p)
+{
+	p->flash.fork_parent = current->policy == SCHED_FLASH &&
+			       !current->sched_reset_on_fork ? current->pid : 0;
+	p->flash.registered = 0;
+	/* The child starts out on its parent's pages */
+	p->flash.numa_node = current->policy == SCHED_FLASH ?
+			     current->flash.numa_node :
+			     cpu_to_node(task_cpu(current));
+}
+
+void flash_fork_register(struct task_struct *p)
+{
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_FORK) | FLASH_CHANGE_DATA,
+		.pid	= p->pid,
+		.pri	= flash_task_pri(p),
+		.gid	= flash_task_gid(p),
+		.data	= p->flash.fork_parent,
+	};
+
+	struct flash_dev *dev;
+
+	rcu_read_lock_sched();
+	dev = flash_cpu_dev(task_cpu(p));
+	if (flash_write_change(dev, farg)) {
+		p->flash.registered = flash_dev_tag(dev);
+		if (flash_task_has_attr(p))
+			flash_attr_write(dev, p);
+		if (p->flash.gang)
+			flash_gang_write(dev, p);
+	}
+	rcu_read_unlock_sched();
+}
+
+/*
+
+Bulk policy switches (the cpu cgroup's flash_policy file) leave the devices
+alone while they move tasks in and out of the class, then send each task's
+state as it is once the switch is done, bracketed by flash_batch_begin() and
+flash_batch_end() so every device can apply its share at once.
+flash_batch_task() is called with p's rq->lock held.
+
+*/
+
+static void flash_batch_write(u32 open)
+{
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_BATCH) | FLASH_CHANGE_DATA,
+		.data	= open,
+	};
+
+	flash_write_all(farg);
+}
+
+void flash_batch_begin(void)
+{
+	flash_batch_write(1);
+}
+
+void flash_batch_end(void)
+{
+	flash_batch_write(0);
+}
+
+void flash_batch_task(struct task_struct *p)
+{
+	p->flash.batched = 0;
+
+	if (p->sched_class == &flash_sched_class && p->on_rq)
+		flash_change(p, FLASH_CHANGE_NEW, TASK_RUNNING);
+	else
+		flash_change(p, FLASH_CHANGE_STATE, TASK_DEAD);
+}
+
 static void
 prio_changed_flash(struct rq *rq, struct task_struct *p, int oldprio)
 {
@@ -340,6 +1914,10 @@ static void switched_to_flash(struct rq *rq, struct task_struct *p)
                     resched_task(rq->curr);
                 }
         }
+
+	/* Back from a PI boost, or a policy switch, with new attributes */
+	if (p->flash.attr_stale)
+		flash_attr_changed(p);
 	printk("switched_to_flash\n");
 }
 
@@ -348,6 +1926,174 @@ void init_flash_rq(struct flash_rq *flash_rq, struct rq *rq)
 {
 	flash_rq->nr_running = 0;
 	INIT_LIST_HEAD(&flash_rq->queue);
+
+	flash_rq->flash_time = 0;
+	flash_rq->flash_throttled = 0;
+
+	RCU_INIT_POINTER(flash_rq->dev, NULL);
+	flash_rq->next_pid = 0;
+	flash_rq->util_sum = 0;
+	flash_rq->util_node = 0;
+	flash_rq->nr_edf = 0;
+}
+
+#ifdef CONFIG_CGROUP_SCHED
+
+/*
+
+FLASH task groups. Sharing the CPUs between groups is left to the device:
+every cgroup gets a group id, which goes out with each change request for
+its tasks, and a weight the device divides the machine by. The root group
+is gid 0 and is never registered, and so are autogroups, which have no
+cgroup. A gid is handed out and taken back from the cgroup's css online and
+offline callbacks, in process context, under flash_weight_mutex like every
+other group message.
+
+*/
+
+static DEFINE_IDA(flash_group_ida);
+static DEFINE_MUTEX(flash_weight_mutex);
+
+static void flash_group_write(struct task_group *tg, unsigned long weight)
+{
+	flash_arg_t farg = {
+		.type	= FLASH_OP(FLASH_OP_GROUP) | FLASH_CHANGE_DATA,
+		.gid	= tg->flash_gid,
+		.data	= weight,
+	};
+
+	flash_write_all(farg);
+}
+
+int online_flash_sched_group(struct task_group *tg)
+{
+	int gid;
+
+	gid = ida_simple_get(&flash_group_ida, 1, FLASH_MAX_GID + 1,
+			     GFP_KERNEL);
+	if (gid < 0)
+		return gid;
+
+	mutex_lock(&flash_weight_mutex);
+	tg->flash_gid = gid;
+	tg->flash_weight = FLASH_WEIGHT_DEFAULT;
+	flash_group_write(tg, tg->flash_weight);
+	mutex_unlock(&flash_weight_mutex);
+
+	return 0;
+}
+
+void offline_flash_sched_group(struct task_group *tg)
+{
+	int gid = tg->flash_gid;
+
+	if (!gid)
+		return;
+
+	/* A zero weight tells the device the group is gone */
+	mutex_lock(&flash_weight_mutex);
+	flash_group_write(tg, 0);
+	tg->flash_gid = 0;
+	mutex_unlock(&flash_weight_mutex);
+
+	ida_simple_remove(&flash_group_ida, gid);
+}
+
+/* Tell a device that has just registered about every group that exists */
+static void flash_resync_groups(struct flash_dev *dev)
+{
+	struct task_group *tg;
+
+	mutex_lock(&flash_weight_mutex);
+	rcu_read_lock();
+	list_for_each_entry_rcu(tg, &task_groups, list) {
+		flash_arg_t farg = {
+			.type	= FLASH_OP(FLASH_OP_GROUP) | FLASH_CHANGE_DATA,
+			.gid	= tg->flash_gid,
+			.data	= tg->flash_weight,
+		};
+
+		if (tg->flash_gid)
+			flash_write_change(dev, farg);
+	}
+	rcu_read_unlock();
+	mutex_unlock(&flash_weight_mutex);
+}
+
+int sched_group_set_flash_weight(struct task_group *tg, unsigned long weight)
+{
+	/* The root group's share is whatever the others leave */
+	if (!tg->flash_gid)
+		return -EINVAL;
+
+	if (weight < FLASH_MIN_WEIGHT || weight > FLASH_MAX_WEIGHT)
+		return -EINVAL;
+
+	mutex_lock(&flash_weight_mutex);
+	if (tg->flash_weight != weight) {
+		tg->flash_weight = weight;
+		flash_group_write(tg, weight);
+	}
+	mutex_unlock(&flash_weight_mutex);
+
+	return 0;
+}
+
+#else
+
+static inline void flash_resync_groups(struct flash_dev *dev)
+{
+}
+
+#endif /* CONFIG_CGROUP_SCHED */
+
+/*
+
+Attach. A device registering while FLASH tasks already run has never heard of
+them, so before anything else it gets one batch with the state of its CPUs,
+every task group and every FLASH task queued on its CPUs. Tasks enqueued
+while the sweep runs may be announced twice; a repeated NEW only refreshes
+the device's entry. Called with flash_devs_mutex held, after dev's CPUs have
+been bound to it.
+
+*/
+
+static void flash_resync_device(struct flash_dev *dev)
+{
+	int cpu;
+
+	flash_op_write(dev, FLASH_OP_BATCH, 1);
+
+	for_each_cpu(cpu, &dev->cpus) {
+		if (!cpu_active(cpu))
+			flash_op_write(dev, FLASH_OP_CPU_OFFLINE, cpu);
+		else if (cpu_rq(cpu)->flash.flash_throttled)
+			flash_op_write(dev, FLASH_OP_THROTTLE, cpu);
+	}
+
+	flash_resync_groups(dev);
+	sched_flash_resync(dev);
+
+	flash_op_write(dev, FLASH_OP_BATCH, 0);
+}
+
+/*
+
+Called by sched_flash_resync() for each FLASH task, with p's rq->lock held.
+A fork registration, or a CPU, remembered for an earlier device that had the
+same id is stale: the first enqueue has to tell the new device afresh.
+
+*/
+
+void flash_resync_task(struct flash_dev *dev, struct task_struct *p)
+{
+	if (p->flash.registered == flash_dev_tag(dev))
+		p->flash.registered = 0;
+	if (p->flash.dev_tag == flash_dev_tag(dev))
+		p->flash.dev_tag = 0;
+
+	if (p->on_rq && !p->flash.batched && flash_cpu_dev(task_cpu(p)) == dev)
+		__flash_change(dev, p, FLASH_CHANGE_NEW, TASK_RUNNING);
 }
 
 const struct sched_class flash_sched_class = {
@@ -364,11 +2110,16 @@ const struct sched_class flash_sched_class = {
 	.pick_next_task		= pick_next_task_flash,
 	.put_prev_task		= put_prev_task_flash,
 
-	// Not present without SMP
-	// .select_task_rq		= select_task_rq_flash,
+#ifdef CONFIG_SMP
+	.select_task_rq		= select_task_rq_flash,
+
+	.rq_online		= rq_online_flash,
+	.rq_offline		= rq_offline_flash,
+#endif
 
 	.set_curr_task          = set_curr_task_flash,
 	.task_tick		= task_tick_flash,
+	.task_fork		= task_fork_flash,
 
 	.prio_changed		= prio_changed_flash,
 	.switched_to		= switched_to_flash,
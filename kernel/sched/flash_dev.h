@@ -4,21 +4,127 @@
 #define SCHED_REQ  0
 #define CHANGE_REQ 1
 
+/*
+ * flash_arg_t.type for change requests: bits 0-2 are change flags for
+ * the task named by pid, bits 3-6 select a control operation and bit 7
+ * says a third word (flash_arg_t.data) follows the message.
+ *
+ * A message that makes a task runnable (FLASH_CHANGE_STATE to anything
+ * but TASK_DEAD) carries the CPU the task is queued on in data, and a
+ * SCHED_REQ carries the CPU asking for a decision, so the device keeps
+ * one queue per CPU.  The device remembers a task's CPU, also across
+ * TASK_DEAD: a runnable message without data queues the task on the CPU
+ * it was last queued on (or moved to by CPU_MOVE).
+ *
+ * A task with a deadline (FLASH_OP_DEADLINE) is picked before every task
+ * without one, earliest deadline first.  FLASH_CHANGE_NEW drops it; the
+ * deadline of a task that has one follows its runnable messages.
+ *
+ * A device with FLASH_DEV_GANG runs the members of a gang (FLASH_OP_GANG)
+ * together: when it picks one for a CPU it also picks a runnable member
+ * queued on each other CPU that has one, and posts those decisions with
+ * flash_post_decision() so that all of them switch in the same quantum.
+ * FLASH_CHANGE_NEW and FLASH_OP_FORK take a task out of its gang.
+ */
+#define FLASH_CHANGE_PRI       (1 << 0)
+#define FLASH_CHANGE_STATE     (1 << 1)
+#define __FLASH_CHANGE_NEW     (1 << 2)
+#define FLASH_CHANGE_NEW       (__FLASH_CHANGE_NEW | \
+		                            FLASH_CHANGE_PRI | \
+		                            FLASH_CHANGE_STATE)
+
+#define FLASH_OP_SHIFT         3
+#define FLASH_OP(op)           ((op) << FLASH_OP_SHIFT)
+#define FLASH_OP_MASK          FLASH_OP(0xf)
+#define FLASH_CHANGE_DATA      (1 << 7)
+
+/* Control operations */
+#define FLASH_OP_NONE          0
+#define FLASH_OP_GROUP         1	/* gid: group; data: weight, 0 frees */
+#define FLASH_OP_THROTTLE      2	/* data: cpu out of FLASH bandwidth */
+#define FLASH_OP_UNTHROTTLE    3	/* data: cpu with fresh bandwidth */
+#define FLASH_OP_CPU_ONLINE    4	/* data: cpu coming up */
+#define FLASH_OP_CPU_OFFLINE   5	/* data: cpu going down, stop picking */
+#define FLASH_OP_CPU_MOVE      6	/* data: src cpu | dst cpu << 16 */
+#define FLASH_OP_FORK          7	/* pid, pri, gid: child; data: parent
+					   pid to inherit from, 0 for none */
+#define FLASH_OP_BATCH         8	/* data: 1 opens a batch of task
+					   changes to be applied at once, 0
+					   closes it */
+#define FLASH_OP_RUNTIME       9	/* pid: task leaving the CPU; data: us
+					   it ran, FLASH_DEV_RUNTIME only */
+#define FLASH_OP_UTIL          10	/* pid: task being queued; data: its
+					   load, 0-1024, FLASH_DEV_UTIL only */
+#define FLASH_OP_ATTR          11	/* pid: task; state: weight, pri:
+					   latency class, data: slice in us,
+					   see sched_flash_attr; 0 for the
+					   defaults; FLASH_DEV_ATTR only */
+#define FLASH_OP_DEADLINE      12	/* pid: task; data: absolute deadline
+					   in us, low 32 bits, compare as
+					   (s32)(a - b); state: 0 drops it.
+					   FLASH_DEV_DEADLINE only */
+#define FLASH_OP_GANG          13	/* pid: task; data: its gang, 0 for
+					   none; FLASH_DEV_GANG only */
+
+#define flash_op(type)         (((type) & FLASH_OP_MASK) >> FLASH_OP_SHIFT)
+
 typedef struct {
 	u8  type;
 	u16 pid;
-	u8  pri;
+	u8  pri;	/* level, lower first; see flash_task_pri() in flash.c */
 	u16 state;
+	u16 gid;
+	u32 data;
 } flash_arg_t;
 
+/*
+ * Transaction recorder records (debugfs flash/trace<cpu>, see flash.c).
+ * The layout is fixed at FLASH_TRACE_VERSION; fields are only ever
+ * added in place of __pad, with a new version.
+ */
+#define FLASH_TRACE_VERSION    3
+
+#define FLASH_TRACE_CHANGE     0	/* change_write_to_flash */
+#define FLASH_TRACE_SCHED      1	/* sched_write_to_flash, ret is valid */
+
+struct flash_trace_record {
+	u64 ts;		/* local_clock() ns when the message was sent */
+	u32 latency;	/* ns until the device call returned */
+	u32 data;
+	u16 pid;
+	u16 ret;	/* PID returned by the device */
+	u16 state;
+	u16 gid;
+	u16 cpu;
+	u8  kind;
+	u8  type;
+	u8  pri;
+	u8  dev;	/* flash_dev.id, since version 2 */
+	u8  version;	/* FLASH_TRACE_VERSION, since version 3; 0 before */
+	u8  __pad[1];
+};
+
 struct flash_dev {
 	struct resource res; /* Resource: our registers */
 	void __iomem *virtbase; /* Where registers can be accessed in memory */
 	void (*change_write_to_flash) (struct flash_dev *dev, flash_arg_t vla);
 	uint16_t (*sched_write_to_flash)  (struct flash_dev *dev, flash_arg_t vla);
-	int irq_pending;
-	uint32_t next_task;
+	struct cpumask cpus; /* CPUs this device schedules; empty for all */
+	int id; /* Set by flash_register_device() */
+	unsigned int flags; /* FLASH_DEV_* */
 };
 
-#endif
+/* struct flash_dev.flags */
+#define FLASH_DEV_RUNTIME      (1 << 0)	/* wants FLASH_OP_RUNTIME */
+#define FLASH_DEV_UTIL         (1 << 1)	/* wants FLASH_OP_UTIL */
+#define FLASH_DEV_ATTR         (1 << 2)	/* wants FLASH_OP_ATTR */
+#define FLASH_DEV_DEADLINE     (1 << 3)	/* picks by FLASH_OP_DEADLINE */
+#define FLASH_DEV_GANG         (1 << 4)	/* co-schedules FLASH_OP_GANG */
+
+#define FLASH_MAX_DEVS         8
 
+extern int flash_register_device(struct flash_dev *dev);
+extern void flash_unregister_device(struct flash_dev *dev);
+extern void flash_post_decision(int cpu, u16 pid);
+
+#endif
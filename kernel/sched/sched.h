@@ -45,6 +45,32 @@ extern __read_mostly int scheduler_running;
  */
 #define RUNTIME_INF	((u64)~0ULL)
 
+/*
+ * Period and runtime, in us, of the bandwidth FLASH tasks may use
+ * (sched_flash_period_us / sched_flash_runtime_us, see flash.c):
+ */
+extern unsigned int sysctl_sched_flash_period;
+extern int sysctl_sched_flash_runtime;
+
+/*
+ * Policy of the children of sched_reset_on_fork tasks
+ * (sched_flash_reset_on_fork):
+ */
+#define FLASH_RESET_KEEP	0	/* RT -> SCHED_NORMAL, FLASH stays */
+#define FLASH_RESET_TO_FLASH	1	/* RT -> SCHED_FLASH */
+#define FLASH_RESET_TO_NORMAL	2	/* RT and FLASH -> SCHED_NORMAL */
+
+extern int sysctl_sched_flash_reset_on_fork;
+
+/*
+ * Ticks a FLASH task runs before the next one on a CPU that no FLASH
+ * device schedules; 100ms, as RR_TIMESLICE:
+ */
+#define FLASH_TIMESLICE		(100 * HZ / 1000)
+
+/* Load of a FLASH task that is always runnable (sched_flash_entity.util_avg) */
+#define FLASH_UTIL_SCALE	1024
+
 static inline int rt_policy(int policy)
 {
 	if (policy == SCHED_FIFO || policy == SCHED_RR)
@@ -73,6 +99,14 @@ struct rt_bandwidth {
 	struct hrtimer		rt_period_timer;
 };
 
+struct flash_bandwidth {
+	/* nests inside the rq lock: */
+	raw_spinlock_t		flash_runtime_lock;
+	ktime_t			flash_period;
+	u64			flash_runtime;
+	struct hrtimer		flash_period_timer;
+};
+
 extern struct mutex sched_domains_mutex;
 
 #ifdef CONFIG_CGROUP_SCHED
@@ -137,6 +171,10 @@ struct task_group {
 #endif
 
 	struct cfs_bandwidth cfs_bandwidth;
+
+	/* FLASH group id and weight, as registered with the device */
+	u16 flash_gid;
+	unsigned long flash_weight;
 };
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -154,6 +192,15 @@ struct task_group {
 #define MAX_SHARES	(1UL << 18)
 #endif
 
+/*
+ * FLASH group weights share the range and default of CFS shares; group
+ * ids are the 16-bit gid field of a device change request.
+ */
+#define FLASH_WEIGHT_DEFAULT	1024UL
+#define FLASH_MIN_WEIGHT	(1UL <<  1)
+#define FLASH_MAX_WEIGHT	(1UL << 18)
+#define FLASH_MAX_GID		0xffff
+
 /* Default task group.
  *	Every task in system belong to this group at bootup.
  */
@@ -196,6 +243,10 @@ extern void init_tg_rt_entry(struct task_group *tg, struct rt_rq *rt_rq,
 		struct sched_rt_entity *rt_se, int cpu,
 		struct sched_rt_entity *parent);
 
+extern int online_flash_sched_group(struct task_group *tg);
+extern void offline_flash_sched_group(struct task_group *tg);
+extern int sched_group_set_flash_weight(struct task_group *tg, unsigned long weight);
+
 #else /* CONFIG_CGROUP_SCHED */
 
 struct cfs_bandwidth { };
@@ -324,9 +375,29 @@ struct rt_rq {
 #endif
 };
 
+static inline int flash_bandwidth_enabled(void)
+{
+	return sysctl_sched_flash_runtime >= 0;
+}
+
 struct flash_rq {
 	int nr_running;
 	struct list_head queue;
+
+	/* Runtime used in the current period; protected by rq->lock */
+	u64 flash_time;
+	int flash_throttled;
+
+	/* Device that schedules this CPU, NULL for none; see flash.c */
+	struct flash_dev __rcu *dev;
+	/* PID the device posted for the next pick, 0 for none; xchg() only */
+	u32 next_pid;
+	/* Sum of the queued tasks' util_avg, see flash.c */
+	unsigned long util_sum;
+	/* Part of util_sum already added to the node's summary */
+	unsigned long util_node;
+	/* Queued tasks with a deadline (EDF) */
+	int nr_edf;
 };
 
 #ifdef CONFIG_SMP
@@ -696,6 +767,19 @@ static inline u64 global_rt_runtime(void)
 	return (u64)sysctl_sched_rt_runtime * NSEC_PER_USEC;
 }
 
+static inline u64 global_flash_period(void)
+{
+	return (u64)sysctl_sched_flash_period * NSEC_PER_USEC;
+}
+
+static inline u64 global_flash_runtime(void)
+{
+	if (sysctl_sched_flash_runtime < 0)
+		return RUNTIME_INF;
+
+	return (u64)sysctl_sched_flash_runtime * NSEC_PER_USEC;
+}
+
 
 
 static inline int task_current(struct rq *rq, struct task_struct *p)
@@ -1189,6 +1273,24 @@ extern void init_cfs_rq(struct cfs_rq *cfs_rq);
 extern void init_rt_rq(struct rt_rq *rt_rq, struct rq *rq);
 extern void init_flash_rq(struct flash_rq *flash_rq, struct rq *rq);
 
+extern struct flash_bandwidth def_flash_bandwidth;
+extern void init_flash_bandwidth(struct flash_bandwidth *flash_b, u64 period, u64 runtime);
+extern void flash_fork_register(struct task_struct *p);
+extern void sched_flash_make_default(void);
+extern void sched_flash_resync(struct flash_dev *dev);
+extern void flash_resync_task(struct flash_dev *dev, struct task_struct *p);
+extern void flash_batch_begin(void);
+extern void flash_batch_end(void);
+extern void flash_batch_task(struct task_struct *p);
+extern void flash_attr_changed(struct task_struct *p);
+extern unsigned long flash_edf_bw(u64 runtime, u64 period);
+extern int flash_edf_admit(struct task_struct *p, unsigned long bw);
+extern void flash_edf_release(struct task_struct *p);
+extern bool flash_edf_cpu_busy(void);
+#ifdef CONFIG_HOTPLUG_CPU
+extern int move_queued_flash_tasks(struct rq *src_rq, struct rq *dst_rq);
+#endif
+
 extern void account_cfs_bandwidth_used(int enabled, int was_enabled);
 
 #ifdef CONFIG_NO_HZ
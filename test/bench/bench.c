@@ -0,0 +1,224 @@
+/*
+ * flash_bench: scheduler micro-benchmarks for SCHED_FLASH
+ *
+ * Compares SCHED_FLASH with SCHED_NORMAL and SCHED_FIFO on the same
+ * host.  Each run prints one CSV row:
+ *
+ *   bench,policy,threads,iterations,ops,seconds,ops_per_sec,avg_ns,max_ns
+ *
+ * avg_ns is the mean per-op latency where the benchmark measures one
+ * (idle wakeup) and the mean time per op otherwise.  max_ns is only
+ * filled in where latency is measured.
+ *
+ * Usage:
+ *   flash_bench [-p policy] [-n iterations] [-t threads] [-c cpu]
+ *               [-g gap_us] [-H] <bench>
+ *   flash_bench -l
+ *
+ * Setting SCHED_FIFO or SCHED_FLASH needs CAP_SYS_NICE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static const struct bench *benches[] = {
+	&bench_pipe,
+	&bench_fanout,
+	&bench_yield,
+	&bench_fork,
+	&bench_idle,
+};
+
+#define NR_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static const struct {
+	const char *name;
+	int policy;
+} policies[] = {
+	{ "normal",	SCHED_OTHER },
+	{ "fifo",	SCHED_FIFO },
+	{ "flash",	SCHED_FLASH },
+};
+
+#define NR_POLICIES (sizeof(policies) / sizeof(policies[0]))
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int bench_pin(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return 0;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+void bench_die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+int bench_reap(int nr)
+{
+	int status, ret = 0;
+
+	while (nr--) {
+		if (wait(&status) < 0)
+			return -1;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+	return ret;
+}
+
+static const char *policy_name(int policy)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_POLICIES; i++)
+		if (policies[i].policy == policy)
+			return policies[i].name;
+	return "?";
+}
+
+static int parse_policy(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_POLICIES; i++)
+		if (!strcmp(policies[i].name, name))
+			return policies[i].policy;
+	return -1;
+}
+
+static int set_policy(int policy)
+{
+	struct sched_param param = {
+		.sched_priority = policy == SCHED_FIFO ? 1 : 0,
+	};
+
+	return sched_setscheduler(0, policy, &param);
+}
+
+static void usage(const char *prog)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"usage: %s [options] <bench>\n"
+		"  -p policy  normal, fifo or flash (default normal)\n"
+		"  -n iters   iterations (per thread where it applies)\n"
+		"  -t n       threads, groups or workers\n"
+		"  -c cpu     pin the whole benchmark to one cpu\n"
+		"  -g us      sleep between wakeups (idle, default 1000)\n"
+		"  -H         print the CSV header first\n"
+		"  -l         list benchmarks\n", prog);
+	fprintf(stderr, "benchmarks:\n");
+	for (i = 0; i < NR_BENCHES; i++)
+		fprintf(stderr, "  %-7s %s\n", benches[i]->name,
+			benches[i]->desc);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts opts = {
+		.policy = SCHED_OTHER,
+		.cpu = -1,
+		.gap_us = 1000,
+	};
+	struct bench_result res = { 0 };
+	const struct bench *b = NULL;
+	int header = 0, opt;
+	unsigned int i;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "p:n:t:c:g:Hl")) != -1) {
+		switch (opt) {
+		case 'p':
+			opts.policy = parse_policy(optarg);
+			if (opts.policy < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			opts.iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts.threads = atoi(optarg);
+			break;
+		case 'c':
+			opts.cpu = atoi(optarg);
+			break;
+		case 'g':
+			opts.gap_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			header = 1;
+			break;
+		case 'l':
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	for (i = 0; i < NR_BENCHES; i++)
+		if (!strcmp(benches[i]->name, argv[optind]))
+			b = benches[i];
+	if (!b)
+		usage(argv[0]);
+
+	if (!opts.iterations)
+		opts.iterations = b->def_iterations;
+	if (opts.threads <= 0)
+		opts.threads = b->def_threads;
+
+	if (bench_pin(opts.cpu))
+		bench_die("sched_setaffinity");
+	if (set_policy(opts.policy)) {
+		fprintf(stderr, "sched_setscheduler(%s): %s\n",
+			policy_name(opts.policy), strerror(errno));
+		return 1;
+	}
+
+	if (b->run(&opts, &res)) {
+		fprintf(stderr, "%s: benchmark failed\n", b->name);
+		return 1;
+	}
+
+	if (header)
+		printf("bench,policy,threads,iterations,ops,seconds,"
+		       "ops_per_sec,avg_ns,max_ns\n");
+
+	secs = res.ns / 1e9;
+	printf("%s,%s,%d,%lu,%lu,%.6f,%.0f,%.0f,%llu\n",
+	       b->name, policy_name(opts.policy), opts.threads,
+	       opts.iterations, res.ops, secs,
+	       secs > 0 ? res.ops / secs : 0.0,
+	       res.ops ? (double)(res.lat_ns ? res.lat_ns : res.ns) / res.ops
+		       : 0.0,
+	       (unsigned long long)res.lat_max_ns);
+
+	return 0;
+}
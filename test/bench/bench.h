@@ -0,0 +1,56 @@
+/*
+ * flash_bench: scheduler micro-benchmarks for SCHED_FLASH
+ *
+ * Shared definitions for the individual benchmarks.  Every benchmark
+ * runs under the policy selected on the command line (set with
+ * sched_setscheduler() before any thread or child is created, so the
+ * whole workload inherits it) and reports one CSV row.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef SCHED_FLASH
+#define SCHED_FLASH 7
+#endif
+
+struct bench_opts {
+	int policy;
+	unsigned long iterations;
+	int threads;
+	int cpu;		/* -1: no pinning */
+	unsigned int gap_us;
+};
+
+struct bench_result {
+	unsigned long ops;	/* operations the benchmark counts */
+	uint64_t ns;		/* wall time of the measured section */
+	uint64_t lat_ns;	/* summed per-op latency, 0 if not measured */
+	uint64_t lat_max_ns;
+};
+
+struct bench {
+	const char *name;
+	const char *desc;
+	unsigned long def_iterations;
+	int def_threads;
+	int (*run) (const struct bench_opts *opts, struct bench_result *res);
+};
+
+extern const struct bench bench_pipe;
+extern const struct bench bench_fanout;
+extern const struct bench bench_yield;
+extern const struct bench bench_fork;
+extern const struct bench bench_idle;
+
+uint64_t bench_now_ns(void);
+int bench_pin(int cpu);
+void bench_die(const char *what);
+
+/* Wait for all children, failing if any of them did */
+int bench_reap(int nr);
+
+#endif /* _BENCH_H */
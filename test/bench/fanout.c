@@ -0,0 +1,115 @@
+/*
+ * fanout: hackbench-style message fan-out between process groups
+ *
+ * Each of the -t groups has FANOUT senders and FANOUT receivers.  Every
+ * sender writes -n messages to every receiver in its group, so each
+ * receiver is woken by many writers and the runqueues stay deep.
+ * ops counts messages delivered.
+ */
+
+#include <unistd.h>
+
+#include "bench.h"
+
+#define FANOUT		20
+#define MSG_SIZE	100
+
+static void wait_go(int go)
+{
+	char c;
+
+	if (read(go, &c, 1) < 0)
+		_exit(1);
+}
+
+static void sender(int *wfds, int go, unsigned long iterations)
+{
+	char msg[MSG_SIZE] = { 0 };
+	unsigned long i;
+	int r;
+
+	wait_go(go);
+	for (i = 0; i < iterations; i++)
+		for (r = 0; r < FANOUT; r++)
+			if (write(wfds[r], msg, sizeof(msg)) != sizeof(msg))
+				_exit(1);
+	_exit(0);
+}
+
+static void receiver(int rfd, int go, unsigned long iterations)
+{
+	unsigned long left = iterations * FANOUT * MSG_SIZE;
+	char buf[MSG_SIZE * 4];
+
+	wait_go(go);
+	while (left) {
+		ssize_t n = read(rfd, buf, left < sizeof(buf) ?
+				 left : sizeof(buf));
+
+		if (n <= 0)
+			_exit(1);
+		left -= n;
+	}
+	_exit(0);
+}
+
+static int run(const struct bench_opts *opts, struct bench_result *res)
+{
+	int go[2], group, i;
+	uint64_t start;
+
+	if (pipe(go))
+		bench_die("pipe");
+
+	for (group = 0; group < opts->threads; group++) {
+		int rfds[FANOUT], wfds[FANOUT];
+
+		for (i = 0; i < FANOUT; i++) {
+			int fds[2];
+
+			if (pipe(fds))
+				bench_die("pipe");
+			rfds[i] = fds[0];
+			wfds[i] = fds[1];
+		}
+
+		for (i = 0; i < 2 * FANOUT; i++) {
+			pid_t pid = fork();
+
+			if (pid < 0)
+				bench_die("fork");
+			if (pid)
+				continue;
+
+			close(go[1]);
+			if (i < FANOUT)
+				receiver(rfds[i], go[0], opts->iterations);
+			else
+				sender(wfds, go[0], opts->iterations);
+		}
+
+		for (i = 0; i < FANOUT; i++) {
+			close(rfds[i]);
+			close(wfds[i]);
+		}
+	}
+
+	close(go[0]);
+	start = bench_now_ns();
+	close(go[1]);
+
+	if (bench_reap(opts->threads * 2 * FANOUT))
+		return -1;
+
+	res->ns = bench_now_ns() - start;
+	res->ops = opts->threads * FANOUT * FANOUT * opts->iterations;
+	return 0;
+}
+
+const struct bench bench_fanout = {
+	.name = "fanout",
+	.desc = "hackbench-style fan-out, 20x20 processes per group",
+	.def_iterations = 100,
+	.def_threads = 4,
+	.run = run,
+};
@@ -0,0 +1,387 @@
+/*
+ * flash_cyclic: periodic-wakeup latency for SCHED_FLASH threads
+ *
+ * cyclictest-style measurement: each measurement thread sleeps on an
+ * absolute clock_nanosleep() timer and records how late it woke up
+ * into a 1us-resolution histogram.  Threads are spread round-robin
+ * over the allowed CPUs (or pinned from a list), optional SCHED_OTHER
+ * busy loops provide background load, and the result is reported per
+ * CPU as one CSV row:
+ *
+ *   cpu,policy,prio,threads,samples,min_us,p50_us,p99_us,max_us,overflows
+ *
+ * Running the same command with -p fifo and -p flash compares the
+ * FLASH wakeup path (select_task_rq_flash, check_preempt_curr_flash,
+ * the device decision) with SCHED_FIFO on the same host, and running
+ * it with different -F compares FLASH priority levels.
+ *
+ * Usage:
+ *   flash_cyclic [-p policy] [-P prio] [-F prio] [-t threads]
+ *                [-a cpu,cpu,...]
+ *                [-i interval_us] [-D seconds | -l loops]
+ *                [-b busy_threads] [-H]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef SCHED_FLASH
+#define SCHED_FLASH 7
+#endif
+
+#define HIST_US		10000	/* wakeups later than this are overflows */
+#define NSEC_PER_SEC	1000000000L
+
+struct cyclic_thread {
+	pthread_t thread;
+	int cpu;
+	uint64_t samples, overflows;
+	uint64_t min_us, max_us;
+	uint64_t hist[HIST_US];
+};
+
+static int policy = SCHED_FLASH;
+static int prio = 1;
+static int flash_prio;
+static long interval_us = 1000;
+static unsigned long loops;
+static volatile int stop;
+
+static pthread_barrier_t barrier;
+
+static const struct {
+	const char *name;
+	int policy;
+} policies[] = {
+	{ "normal",	SCHED_OTHER },
+	{ "fifo",	SCHED_FIFO },
+	{ "flash",	SCHED_FLASH },
+};
+
+#define NR_POLICIES (sizeof(policies) / sizeof(policies[0]))
+
+static const char *policy_name(int pol)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_POLICIES; i++)
+		if (policies[i].policy == pol)
+			return policies[i].name;
+	return "?";
+}
+
+static int parse_policy(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_POLICIES; i++)
+		if (!strcmp(policies[i].name, name))
+			return policies[i].policy;
+	return -1;
+}
+
+static int pin_self(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * The sched_priority of a policy: -P for SCHED_FIFO, -F for SCHED_FLASH,
+ * whose priority is a sched_param one too rather than a sched_flash_attr
+ * field.
+ */
+static int policy_prio(int pol)
+{
+	if (pol == SCHED_FIFO)
+		return prio;
+	if (pol == SCHED_FLASH)
+		return flash_prio;
+	return 0;
+}
+
+static int set_policy(int pol)
+{
+	struct sched_param param = {
+		.sched_priority = policy_prio(pol),
+	};
+
+	return sched_setscheduler(0, pol, &param);
+}
+
+static inline void ts_add_ns(struct timespec *ts, long ns)
+{
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= NSEC_PER_SEC) {
+		ts->tv_nsec -= NSEC_PER_SEC;
+		ts->tv_sec++;
+	}
+}
+
+static inline int64_t ts_diff_ns(struct timespec *a, struct timespec *b)
+{
+	return (int64_t)(a->tv_sec - b->tv_sec) * NSEC_PER_SEC +
+	       (a->tv_nsec - b->tv_nsec);
+}
+
+static void *cyclic_fn(void *arg)
+{
+	struct cyclic_thread *t = arg;
+	struct timespec next, now;
+	unsigned long n = 0;
+	int err;
+
+	if (pin_self(t->cpu))
+		fprintf(stderr, "cpu %d: cannot pin\n", t->cpu);
+	if (set_policy(policy)) {
+		fprintf(stderr, "cpu %d: sched_setscheduler(%s): %s\n",
+			t->cpu, policy_name(policy), strerror(errno));
+		exit(1);
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	ts_add_ns(&next, interval_us * 1000);
+
+	while (!stop && (!loops || n++ < loops)) {
+		uint64_t us;
+
+		err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				      &next, NULL);
+		if (err && err != EINTR)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		us = ts_diff_ns(&now, &next) / 1000;
+		if (!t->samples || us < t->min_us)
+			t->min_us = us;
+		if (us > t->max_us)
+			t->max_us = us;
+		if (us < HIST_US)
+			t->hist[us]++;
+		else
+			t->overflows++;
+		t->samples++;
+
+		ts_add_ns(&next, interval_us * 1000);
+		/* Skip periods we slept through rather than bursting */
+		while (ts_diff_ns(&now, &next) > 0)
+			ts_add_ns(&next, interval_us * 1000);
+	}
+
+	return NULL;
+}
+
+static void *busy_fn(void *arg)
+{
+	volatile unsigned long spin = 0;
+
+	pin_self((long)arg);
+	while (!stop)
+		spin++;
+	return NULL;
+}
+
+/* Smallest latency bucket at or below which pct% of samples fall */
+static uint64_t percentile(uint64_t *hist, uint64_t samples,
+			   uint64_t max_us, unsigned int pct)
+{
+	uint64_t want = (samples * pct + 99) / 100, seen = 0, us;
+
+	for (us = 0; us < HIST_US; us++) {
+		seen += hist[us];
+		if (seen >= want)
+			return us;
+	}
+	return max_us;
+}
+
+static int parse_cpus(char *list, int *cpus, int max)
+{
+	char *tok, *save;
+	int n = 0;
+
+	for (tok = strtok_r(list, ",", &save); tok && n < max;
+	     tok = strtok_r(NULL, ",", &save))
+		cpus[n++] = atoi(tok);
+	return n;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -p policy  flash, fifo or normal (default flash)\n"
+		"  -P prio    SCHED_FIFO priority (default 1)\n"
+		"  -F prio    SCHED_FLASH priority, 0-63, higher first (default 0)\n"
+		"  -t n       measurement threads (default: one per cpu)\n"
+		"  -a list    comma-separated cpus to use, round-robin\n"
+		"  -i us      timer interval (default 1000)\n"
+		"  -D sec     run time (default 10)\n"
+		"  -l loops   wakeups per thread instead of a run time\n"
+		"  -b n       SCHED_OTHER busy threads for background load\n"
+		"  -H         print the CSV header first\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct cyclic_thread *threads;
+	pthread_t *busy = NULL;
+	int nr_threads = 0, nr_busy = 0, nr_cpus = 0, header = 0;
+	int duration = 10, opt, i, j, k, c;
+	int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int *cpus;
+
+	cpus = calloc(CPU_SETSIZE, sizeof(*cpus));
+	if (!cpus)
+		return 1;
+
+	while ((opt = getopt(argc, argv, "p:P:F:t:a:i:D:l:b:H")) != -1) {
+		switch (opt) {
+		case 'p':
+			policy = parse_policy(optarg);
+			if (policy < 0)
+				usage(argv[0]);
+			break;
+		case 'P':
+			prio = atoi(optarg);
+			break;
+		case 'F':
+			flash_prio = atoi(optarg);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'a':
+			nr_cpus = parse_cpus(optarg, cpus, CPU_SETSIZE);
+			break;
+		case 'i':
+			interval_us = atol(optarg);
+			break;
+		case 'D':
+			duration = atoi(optarg);
+			break;
+		case 'l':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			nr_busy = atoi(optarg);
+			break;
+		case 'H':
+			header = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (interval_us <= 0 || duration <= 0 || nr_threads < 0 ||
+	    nr_busy < 0)
+		usage(argv[0]);
+
+	if (!nr_cpus)
+		for (nr_cpus = 0; nr_cpus < ncpu; nr_cpus++)
+			cpus[nr_cpus] = nr_cpus;
+	if (!nr_threads)
+		nr_threads = nr_cpus;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		fprintf(stderr, "mlockall: %s (continuing)\n",
+			strerror(errno));
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (nr_busy)
+		busy = calloc(nr_busy, sizeof(*busy));
+	if (!threads || (nr_busy && !busy))
+		return 1;
+
+	for (i = 0; i < nr_busy; i++)
+		pthread_create(&busy[i], NULL, busy_fn,
+			       (void *)(long)cpus[i % nr_cpus]);
+
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].cpu = cpus[i % nr_cpus];
+		if (pthread_create(&threads[i].thread, NULL, cyclic_fn,
+				   &threads[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	pthread_barrier_wait(&barrier);
+
+	if (!loops) {
+		sleep(duration);
+		stop = 1;
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	stop = 1;
+	for (i = 0; i < nr_busy; i++)
+		pthread_join(busy[i], NULL);
+
+	if (header)
+		printf("cpu,policy,prio,threads,samples,min_us,p50_us,p99_us,"
+		       "max_us,overflows\n");
+
+	/* Merge the threads that shared a CPU into one histogram */
+	for (k = 0; k < nr_cpus; k++) {
+		static uint64_t hist[HIST_US];
+		uint64_t samples = 0, overflows = 0, min_us = 0, max_us = 0;
+		int n = 0, us;
+
+		/* -a may name a CPU twice; report it once */
+		c = cpus[k];
+		for (j = 0; j < k && cpus[j] != c; j++)
+			;
+		if (j < k)
+			continue;
+
+		memset(hist, 0, sizeof(hist));
+		for (i = 0; i < nr_threads; i++) {
+			struct cyclic_thread *t = &threads[i];
+
+			if (t->cpu != c || !t->samples)
+				continue;
+			for (us = 0; us < HIST_US; us++)
+				hist[us] += t->hist[us];
+			if (!samples || t->min_us < min_us)
+				min_us = t->min_us;
+			if (t->max_us > max_us)
+				max_us = t->max_us;
+			samples += t->samples;
+			overflows += t->overflows;
+			n++;
+		}
+		if (!n)
+			continue;
+
+		printf("%d,%s,%d,%d,%llu,%llu,%llu,%llu,%llu,%llu\n",
+		       c, policy_name(policy), policy_prio(policy), n,
+		       (unsigned long long)samples,
+		       (unsigned long long)min_us,
+		       (unsigned long long)percentile(hist, samples, max_us, 50),
+		       (unsigned long long)percentile(hist, samples, max_us, 99),
+		       (unsigned long long)max_us,
+		       (unsigned long long)overflows);
+	}
+
+	free(threads);
+	free(busy);
+	free(cpus);
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * fork: fork, exit and reap children as fast as possible
+ *
+ * Covers sched_fork, wake_up_new_task and the exit-time dequeue for
+ * every child.  -t workers each run -n fork/exit/wait cycles.  ops
+ * counts children.
+ */
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static void worker(int go, unsigned long iterations)
+{
+	unsigned long i;
+	char c;
+
+	if (read(go, &c, 1) < 0)
+		_exit(1);
+
+	for (i = 0; i < iterations; i++) {
+		pid_t pid = fork();
+		int status;
+
+		if (pid < 0)
+			_exit(1);
+		if (!pid)
+			_exit(0);
+		if (waitpid(pid, &status, 0) != pid)
+			_exit(1);
+	}
+	_exit(0);
+}
+
+static int run(const struct bench_opts *opts, struct bench_result *res)
+{
+	uint64_t start;
+	int go[2], i;
+
+	if (pipe(go))
+		bench_die("pipe");
+
+	for (i = 0; i < opts->threads; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			bench_die("fork");
+		if (!pid) {
+			close(go[1]);
+			worker(go[0], opts->iterations);
+		}
+	}
+
+	close(go[0]);
+	start = bench_now_ns();
+	close(go[1]);
+
+	if (bench_reap(opts->threads))
+		return -1;
+
+	res->ns = bench_now_ns() - start;
+	res->ops = opts->iterations * opts->threads;
+	return 0;
+}
+
+const struct bench bench_fork = {
+	.name = "fork",
+	.desc = "fork/exit/wait storm",
+	.def_iterations = 10000,
+	.def_threads = 1,
+	.run = run,
+};
@@ -0,0 +1,99 @@
+/*
+ * idle: wake a sleeping thread on an otherwise idle system
+ *
+ * A waker thread sleeps -g microseconds, stamps the time and writes to
+ * a pipe; each of the -t sleeper threads blocks in read() and measures
+ * how long it took to get the CPU back.  The gap lets the CPUs go idle
+ * between wakeups, so this measures the idle-to-running path.  ops
+ * counts wakeups; avg_ns and max_ns are wakeup latencies.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+struct sleeper {
+	pthread_t thread;
+	int fds[2];
+	unsigned long iterations;
+	uint64_t lat_ns, lat_max_ns;
+};
+
+static void *sleeper_fn(void *arg)
+{
+	struct sleeper *s = arg;
+	unsigned long i;
+
+	for (i = 0; i < s->iterations; i++) {
+		uint64_t stamp, lat;
+
+		if (read(s->fds[0], &stamp, sizeof(stamp)) != sizeof(stamp))
+			break;
+		lat = bench_now_ns() - stamp;
+		s->lat_ns += lat;
+		if (lat > s->lat_max_ns)
+			s->lat_max_ns = lat;
+	}
+	return NULL;
+}
+
+static int run(const struct bench_opts *opts, struct bench_result *res)
+{
+	struct sleeper *sleepers;
+	unsigned long i;
+	uint64_t start;
+	int t;
+
+	sleepers = calloc(opts->threads, sizeof(*sleepers));
+	if (!sleepers)
+		bench_die("calloc");
+
+	for (t = 0; t < opts->threads; t++) {
+		struct sleeper *s = &sleepers[t];
+
+		s->iterations = opts->iterations;
+		if (pipe(s->fds))
+			bench_die("pipe");
+		if (pthread_create(&s->thread, NULL, sleeper_fn, s))
+			bench_die("pthread_create");
+	}
+
+	start = bench_now_ns();
+	for (i = 0; i < opts->iterations; i++) {
+		usleep(opts->gap_us);
+		for (t = 0; t < opts->threads; t++) {
+			uint64_t stamp = bench_now_ns();
+
+			if (write(sleepers[t].fds[1], &stamp,
+				  sizeof(stamp)) != sizeof(stamp))
+				bench_die("write");
+		}
+	}
+
+	for (t = 0; t < opts->threads; t++) {
+		struct sleeper *s = &sleepers[t];
+
+		pthread_join(s->thread, NULL);
+		res->lat_ns += s->lat_ns;
+		if (s->lat_max_ns > res->lat_max_ns)
+			res->lat_max_ns = s->lat_max_ns;
+		close(s->fds[0]);
+		close(s->fds[1]);
+	}
+
+	res->ns = bench_now_ns() - start;
+	res->ops = opts->iterations * opts->threads;
+
+	free(sleepers);
+	return 0;
+}
+
+const struct bench bench_idle = {
+	.name = "idle",
+	.desc = "idle-to-running wakeup latency",
+	.def_iterations = 1000,
+	.def_threads = 1,
+	.run = run,
+};
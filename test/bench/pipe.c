@@ -0,0 +1,87 @@
+/*
+ * pipe: ping-pong a byte between two processes over a pair of pipes
+ *
+ * Every round trip is two blocking wakeups, so ops counts context
+ * switches.  -t runs that many independent pairs at once.
+ */
+
+#include <unistd.h>
+
+#include "bench.h"
+
+static void pong(int rfd, int wfd, int go, unsigned long iterations,
+		 int first)
+{
+	unsigned long i;
+	char c = 0;
+
+	/* Block until the parent starts the clock */
+	if (read(go, &c, 1) < 0)
+		_exit(1);
+
+	for (i = 0; i < iterations; i++) {
+		if (first && write(wfd, &c, 1) != 1)
+			_exit(1);
+		if (read(rfd, &c, 1) != 1)
+			_exit(1);
+		if (!first && write(wfd, &c, 1) != 1)
+			_exit(1);
+	}
+	_exit(0);
+}
+
+static int run(const struct bench_opts *opts, struct bench_result *res)
+{
+	int go[2], pair, side;
+	uint64_t start;
+
+	if (pipe(go))
+		bench_die("pipe");
+
+	for (pair = 0; pair < opts->threads; pair++) {
+		int ab[2], ba[2];
+
+		if (pipe(ab) || pipe(ba))
+			bench_die("pipe");
+
+		for (side = 0; side < 2; side++) {
+			pid_t pid = fork();
+
+			if (pid < 0)
+				bench_die("fork");
+			if (!pid) {
+				close(go[1]);
+				if (side)
+					pong(ab[0], ba[1], go[0],
+					     opts->iterations, 0);
+				else
+					pong(ba[0], ab[1], go[0],
+					     opts->iterations, 1);
+			}
+		}
+
+		close(ab[0]);
+		close(ab[1]);
+		close(ba[0]);
+		close(ba[1]);
+	}
+
+	close(go[0]);
+	start = bench_now_ns();
+	close(go[1]);
+
+	if (bench_reap(opts->threads * 2))
+		return -1;
+
+	res->ns = bench_now_ns() - start;
+	res->ops = 2 * opts->iterations * opts->threads;
+	return 0;
+}
+
+const struct bench bench_pipe = {
+	.name = "pipe",
+	.desc = "pipe ping-pong context-switch rate",
+	.def_iterations = 100000,
+	.def_threads = 1,
+	.run = run,
+};
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Run every benchmark under every policy and emit one CSV on stdout.
+#
+#   ./run_bench.sh [runs] [extra flash_bench options] > results.csv
+#
+# Policies the kernel or the caller's privileges reject are skipped
+# with a note on stderr, so the same script runs on stock kernels.
+
+BENCH=${BENCH:-$(dirname "$0")/flash_bench}
+RUNS=${1:-3}
+[ $# -gt 0 ] && shift
+
+header=-H
+for bench in pipe fanout yield fork idle; do
+	for policy in normal fifo flash; do
+		run=0
+		while [ $run -lt "$RUNS" ]; do
+			if ! "$BENCH" $header -p $policy "$@" $bench; then
+				echo "skipping $bench/$policy" >&2
+				break
+			fi
+			header=
+			run=$((run + 1))
+		done
+	done
+done
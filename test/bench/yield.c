@@ -0,0 +1,61 @@
+/*
+ * yield: threads calling sched_yield() back to back
+ *
+ * Exercises the class yield path and pick_next_task with every thread
+ * permanently runnable.  ops counts sched_yield() calls.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+static pthread_barrier_t barrier;
+
+static void *yielder(void *arg)
+{
+	unsigned long i, iterations = *(unsigned long *)arg;
+
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < iterations; i++)
+		sched_yield();
+	return NULL;
+}
+
+static int run(const struct bench_opts *opts, struct bench_result *res)
+{
+	unsigned long iterations = opts->iterations;
+	pthread_t *threads;
+	uint64_t start;
+	int i;
+
+	threads = calloc(opts->threads, sizeof(*threads));
+	if (!threads)
+		bench_die("calloc");
+
+	pthread_barrier_init(&barrier, NULL, opts->threads + 1);
+	for (i = 0; i < opts->threads; i++)
+		if (pthread_create(&threads[i], NULL, yielder, &iterations))
+			bench_die("pthread_create");
+
+	start = bench_now_ns();
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < opts->threads; i++)
+		pthread_join(threads[i], NULL);
+
+	res->ns = bench_now_ns() - start;
+	res->ops = iterations * opts->threads;
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+	return 0;
+}
+
+const struct bench bench_yield = {
+	.name = "yield",
+	.desc = "sched_yield() storm",
+	.def_iterations = 100000,
+	.def_threads = 4,
+	.run = run,
+};
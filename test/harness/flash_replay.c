@@ -0,0 +1,1006 @@
+/*
+ * flash_replay: drive kernel/sched/flash.c from user space
+ *
+ * The class is compiled unmodified against the mock scheduler core in
+ * mock/ and a software model of the device (model.c).  A trace of
+ * scheduler events is replayed through the class exactly as core.c
+ * would call it, and the replay reports scheduling decisions per
+ * second, per-operation latency and, where perf events are available,
+ * cache misses.
+ *
+ * Trace format, one event per line ('#' starts a comment):
+ *
+ *   new   <cpu> <pid> <prio> [<flash>]
+ *                              fork + wake_up_new_task; prio is the
+ *                              kernel priority (100-139), flash the
+ *                              SCHED_FLASH sched_priority (default 0)
+ *   wake  <cpu> <pid>          try_to_wake_up
+ *   sleep <cpu> <pid>          block and deactivate (schedules if current)
+ *   exit  <cpu> <pid>          exit (schedules if current)
+ *   tick  <cpu>                scheduler_tick (schedules on resched)
+ *   pick  <cpu>                schedule()
+ *   yield <cpu>                sched_yield() + schedule()
+ *   offline <cpu>              CPU_DYING: rq_offline + migrate_tasks()
+ *   online  <cpu>              CPU_ONLINE: rq_online
+ *   edf   <cpu> <pid> <runtime_us> <period_us>
+ *                              sched_flash_setattr() of an EDF
+ *                              reservation with deadline = period;
+ *                              runtime 0 drops it
+ *   gang  <cpu> <pid> <tgid>   sched_flash_setattr() of
+ *                              SCHED_FLASH_FLAG_GANG, as a thread of
+ *                              tgid; tgid 0 leaves the gang
+ *
+ * Usage:
+ *   flash_replay [-m model] [-c cpus] [-l llc] [-n node] [-r repeat]
+ *                [-b runtime_us] [-p period_us] [-v] trace
+ *   flash_replay [-m model] [-c cpus] [-l llc] [-n node] [-t tasks]
+ *                [-s seed] -g ops [-w out]
+ *   flash_replay [-m model] -R recording
+ *
+ * -R feeds a recording of real device transactions (the kernel's
+ * debugfs flash/trace<cpu> files, concatenated in any order) straight
+ * to the model and reports how often the model picks the PID the
+ * device picked.
+ *
+ * Every tick advances the mock clock by one HZ=1000 tick's share of the
+ * CPUs and runs any expired hrtimers, so FLASH bandwidth throttling
+ * behaves as it would on a loaded machine.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mock.h"
+#include "model.h"
+
+enum replay_op {
+	OP_NEW,
+	OP_WAKE,
+	OP_SLEEP,
+	OP_EXIT,
+	OP_TICK,
+	OP_PICK,
+	OP_YIELD,
+	OP_OFFLINE,
+	OP_ONLINE,
+	OP_EDF,
+	OP_GANG,
+	NR_OPS,
+};
+
+static const char * const op_names[NR_OPS] = {
+	[OP_NEW]	= "new",
+	[OP_WAKE]	= "wake",
+	[OP_SLEEP]	= "sleep",
+	[OP_EXIT]	= "exit",
+	[OP_TICK]	= "tick",
+	[OP_PICK]	= "pick",
+	[OP_YIELD]	= "yield",
+	[OP_OFFLINE]	= "offline",
+	[OP_ONLINE]	= "online",
+	[OP_EDF]	= "edf",
+	[OP_GANG]	= "gang",
+};
+
+struct replay_event {
+	u8  op;
+	u16 cpu;
+	u16 pid;
+	u8  prio;
+	u8  flash_prio;
+	u16 tgid;		/* OP_GANG */
+	u32 dl_runtime_us;	/* OP_EDF */
+	u32 dl_period_us;
+};
+
+struct replay_trace {
+	struct replay_event *ev;
+	size_t nr, alloc;
+};
+
+#define NR_LAT_BUCKETS 64
+
+struct op_stats {
+	unsigned long count;
+	u64 total_ns, min_ns, max_ns;
+	unsigned long hist[NR_LAT_BUCKETS];	/* log2(ns) buckets */
+};
+
+static struct op_stats stats[NR_OPS];
+static unsigned long nr_decisions, nr_idle_decisions, nr_bad_decisions;
+
+/*
+ * Trace construction
+ */
+
+static struct replay_event *trace_add(struct replay_trace *t, int op,
+				      int cpu, int pid, int prio,
+				      int flash_prio)
+{
+	if (t->nr == t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 4096;
+		t->ev = realloc(t->ev, t->alloc * sizeof(*t->ev));
+		if (!t->ev) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	t->ev[t->nr].op = op;
+	t->ev[t->nr].cpu = cpu;
+	t->ev[t->nr].pid = pid;
+	t->ev[t->nr].prio = prio;
+	t->ev[t->nr].flash_prio = flash_prio;
+	t->ev[t->nr].tgid = 0;
+	t->ev[t->nr].dl_runtime_us = t->ev[t->nr].dl_period_us = 0;
+	return &t->ev[t->nr++];
+}
+
+/*
+ * Check the nr_args numbers that follow op on a trace line and add the
+ * event; -1 if they do not make one.
+ */
+static int trace_parse(struct replay_trace *t, int op, const int *args,
+		       int nr_args, int nr_cpus)
+{
+	int cpu = args[0], pid = args[1];
+	int prio, flash_prio, runtime_us, period_us, tgid;
+	struct replay_event *e;
+
+	if (nr_args < 1 || cpu < 0 || cpu >= nr_cpus)
+		return -1;
+
+	switch (op) {
+	case OP_TICK:
+	case OP_PICK:
+	case OP_YIELD:
+	case OP_OFFLINE:
+	case OP_ONLINE:
+		trace_add(t, op, cpu, 0, 0, 0);
+		return 0;
+	}
+
+	/* The rest name a task */
+	if (nr_args < 2 || pid <= 0 || pid >= MOCK_PID_MAX)
+		return -1;
+
+	switch (op) {
+	case OP_NEW:
+		prio = nr_args > 2 ? args[2] : 120;
+		flash_prio = nr_args > 3 ? args[3] : 0;
+		if (prio < 0 || prio >= MAX_PRIO)
+			return -1;
+		if (flash_prio < 0 || flash_prio >= MAX_USER_FLASH_PRIO)
+			return -1;
+		trace_add(t, op, cpu, pid, prio, flash_prio);
+		return 0;
+
+	case OP_EDF:
+		if (nr_args != 4)
+			return -1;
+		runtime_us = args[2];
+		period_us = args[3];
+		if (runtime_us < 0 || period_us < 0)
+			return -1;
+		/* The bounds sched_flash_setattr() puts on a reservation */
+		if (runtime_us &&
+		    (runtime_us * 1000ULL < SCHED_FLASH_DL_RUNTIME_MIN_NS ||
+		     runtime_us > period_us ||
+		     period_us * 1000ULL > SCHED_FLASH_DL_PERIOD_MAX_NS))
+			return -1;
+		e = trace_add(t, op, cpu, pid, 0, 0);
+		e->dl_runtime_us = runtime_us;
+		e->dl_period_us = runtime_us ? period_us : 0;
+		return 0;
+
+	case OP_GANG:
+		if (nr_args != 3)
+			return -1;
+		tgid = args[2];
+		if (tgid < 0 || tgid >= MOCK_PID_MAX)
+			return -1;
+		e = trace_add(t, op, cpu, pid, 0, 0);
+		e->tgid = tgid;
+		return 0;
+
+	default:
+		trace_add(t, op, cpu, pid, 0, 0);
+		return 0;
+	}
+}
+
+static int trace_load(struct replay_trace *t, const char *path, int nr_cpus)
+{
+	char line[256], name[16];
+	int lineno = 0, op, args[4], n;
+	FILE *f;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *hash = strchr(line, '#');
+
+		lineno++;
+		if (hash)
+			*hash = '\0';
+
+		memset(args, 0, sizeof(args));
+		n = sscanf(line, "%15s %d %d %d %d", name, &args[0], &args[1],
+			   &args[2], &args[3]);
+		if (n <= 0)
+			continue;
+
+		for (op = 0; op < NR_OPS; op++)
+			if (!strcmp(name, op_names[op]))
+				break;
+
+		if (op == NR_OPS || trace_parse(t, op, args, n - 1, nr_cpus)) {
+			fprintf(stderr, "%s:%d: bad event\n", path, lineno);
+			if (f != stdin)
+				fclose(f);
+			return -1;
+		}
+	}
+
+	if (f != stdin)
+		fclose(f);
+	return 0;
+}
+
+/*
+ * Synthesize a plausible mix: every task is created up front, the
+ * first four of every sixteen as a gang, then ticks and schedules
+ * dominate with a steady stream of sleeps and wakeups, and finally
+ * everything exits.
+ */
+static void trace_generate(struct replay_trace *t, unsigned long nr_ops,
+			   int nr_tasks, int nr_cpus, unsigned int seed)
+{
+	unsigned char *running;
+	unsigned long i;
+	int pid;
+
+	srand(seed);
+	running = calloc(nr_tasks + 1, 1);
+	if (!running) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (pid = 1; pid <= nr_tasks; pid++) {
+		trace_add(t, OP_NEW, pid % nr_cpus, pid, 100 + rand() % 40,
+			  rand() % MAX_USER_FLASH_PRIO);
+		running[pid] = 1;
+		if ((pid - 1) % 16 < 4)
+			trace_add(t, OP_GANG, pid % nr_cpus, pid, 0, 0)->tgid =
+				pid - (pid - 1) % 16;
+	}
+
+	for (i = 0; i < nr_ops; i++) {
+		int r = rand() % 100, cpu = rand() % nr_cpus;
+
+		pid = 1 + rand() % nr_tasks;
+
+		if (r < 40)
+			trace_add(t, OP_TICK, cpu, 0, 0, 0);
+		else if (r < 60)
+			trace_add(t, OP_PICK, cpu, 0, 0, 0);
+		else if (r < 65)
+			trace_add(t, OP_YIELD, cpu, 0, 0, 0);
+		else if (running[pid]) {
+			trace_add(t, OP_SLEEP, cpu, pid, 0, 0);
+			running[pid] = 0;
+		} else {
+			trace_add(t, OP_WAKE, cpu, pid, 0, 0);
+			running[pid] = 1;
+		}
+	}
+
+	for (pid = 1; pid <= nr_tasks; pid++)
+		trace_add(t, OP_EXIT, 0, pid, 0, 0);
+
+	free(running);
+}
+
+static int trace_write(struct replay_trace *t, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	size_t i;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	fprintf(f, "# op cpu pid prio flash\n");
+	for (i = 0; i < t->nr; i++) {
+		struct replay_event *e = &t->ev[i];
+
+		switch (e->op) {
+		case OP_NEW:
+			fprintf(f, "new %u %u %u %u\n", e->cpu, e->pid, e->prio,
+				e->flash_prio);
+			break;
+		case OP_WAKE:
+		case OP_SLEEP:
+		case OP_EXIT:
+			fprintf(f, "%s %u %u\n", op_names[e->op], e->cpu,
+				e->pid);
+			break;
+		case OP_GANG:
+			fprintf(f, "gang %u %u %u\n", e->cpu, e->pid, e->tgid);
+			break;
+		case OP_EDF:
+			fprintf(f, "edf %u %u %u %u\n", e->cpu, e->pid,
+				e->dl_runtime_us, e->dl_period_us);
+			break;
+		default:
+			fprintf(f, "%s %u\n", op_names[e->op], e->cpu);
+		}
+	}
+
+	return fclose(f);
+}
+
+/*
+ * The slice of core.c the replay needs
+ */
+
+static void replay_check_preempt(struct rq *rq, struct task_struct *p)
+{
+	/* FLASH sits above everything the mock keeps below it */
+	if (rq->curr->sched_class == p->sched_class)
+		p->sched_class->check_preempt_curr(rq, p, 0);
+	else
+		resched_task(rq->curr);
+}
+
+static void replay_schedule(struct rq *rq)
+{
+	struct task_struct *prev = rq->curr, *next;
+
+	raw_spin_lock(&rq->lock);
+
+	if (prev->sched_class == &flash_sched_class)
+		flash_sched_class.put_prev_task(rq, prev);
+
+	next = flash_sched_class.pick_next_task(rq);
+	nr_decisions++;
+
+	/* The device only knows PIDs; it may hand back one we cannot run */
+	if (next && (!next->on_rq || next->cpu != cpu_of(rq) ||
+		     (next != prev && next == cpu_rq(next->cpu)->curr))) {
+		nr_bad_decisions++;
+		next = NULL;
+	}
+	if (!next) {
+		nr_idle_decisions++;
+		next = rq->idle;
+	}
+
+	prev->need_resched = 0;
+	rq->curr = next;
+
+	raw_spin_unlock(&rq->lock);
+}
+
+/*
+ * As migration_call(CPU_DYING): the stopper preempts whatever runs on
+ * the dying CPU, then migrate_tasks() moves its FLASH tasks to the least
+ * loaded active CPU.  The last active CPU is never taken down.
+ */
+static void replay_cpu_offline(struct rq *rq)
+{
+	struct task_struct *prev = rq->curr;
+	struct rq *dest_rq = NULL;
+	int cpu;
+
+	mock_cpu_active_mask.bits &= ~(1ULL << cpu_of(rq));
+	for_each_cpu_and(cpu, cpumask_of_node(cpu_to_node(cpu_of(rq))),
+			 cpu_active_mask) {
+		if (!dest_rq ||
+		    cpu_rq(cpu)->flash.util_sum < dest_rq->flash.util_sum)
+			dest_rq = cpu_rq(cpu);
+	}
+	/* Off the node only if none of its CPUs is left, as core.c does */
+	if (!dest_rq) {
+		for_each_cpu(cpu, cpu_active_mask) {
+			if (!dest_rq || cpu_rq(cpu)->flash.util_sum <
+					dest_rq->flash.util_sum)
+				dest_rq = cpu_rq(cpu);
+		}
+	}
+	if (!dest_rq) {
+		mock_cpu_active_mask.bits |= 1ULL << cpu_of(rq);
+		return;
+	}
+
+	raw_spin_lock(&rq->lock);
+	if (prev->sched_class == &flash_sched_class)
+		flash_sched_class.put_prev_task(rq, prev);
+	prev->need_resched = 0;
+	rq->curr = rq->idle;
+
+	flash_sched_class.rq_offline(rq);
+
+	raw_spin_lock(&dest_rq->lock);
+	move_queued_flash_tasks(rq, dest_rq);
+	raw_spin_unlock(&dest_rq->lock);
+	raw_spin_unlock(&rq->lock);
+
+	if (dest_rq->curr->need_resched)
+		replay_schedule(dest_rq);
+}
+
+static void replay_event(struct replay_event *e)
+{
+	struct rq *rq = cpu_rq(e->cpu);
+	struct task_struct *p = e->pid ? find_task_by_vpid(e->pid) : NULL;
+	int cpu, on_rq, running;
+
+	/* Nothing runs on a CPU that is down */
+	if ((e->op == OP_TICK || e->op == OP_PICK || e->op == OP_YIELD) &&
+	    !cpumask_test_cpu(e->cpu, cpu_active_mask))
+		return;
+
+	switch (e->op) {
+	case OP_NEW:
+		if (p)
+			break;
+		p = mock_task_new(e->pid, e->prio, e->cpu);
+		if (!p)
+			break;
+		p->rt_priority = e->flash_prio;
+		/* Forked by whatever runs on that CPU */
+		mock_current = rq->curr;
+		if (flash_sched_class.task_fork)
+			flash_sched_class.task_fork(p);
+		flash_fork_register(p);
+		/* fall through */
+	case OP_WAKE:
+		if (!p || p->on_rq)
+			break;
+		if (e->op == OP_WAKE)
+			p->state = TASK_WAKING;
+		cpu = e->cpu;
+		/* Woken, like forked, by whatever runs on the event's CPU */
+		mock_current = cpu_rq(e->cpu)->curr;
+		if (flash_sched_class.select_task_rq)
+			cpu = flash_sched_class.select_task_rq(p,
+				e->op == OP_NEW ? SD_BALANCE_FORK :
+						  SD_BALANCE_WAKE, 0);
+		p->cpu = cpu;
+		rq = cpu_rq(cpu);
+
+		raw_spin_lock(&rq->lock);
+		flash_sched_class.enqueue_task(rq, p, 0);
+		p->on_rq = 1;
+		replay_check_preempt(rq, p);
+		p->state = TASK_RUNNING;
+		raw_spin_unlock(&rq->lock);
+		break;
+
+	case OP_SLEEP:
+	case OP_EXIT:
+		if (!p)
+			break;
+		rq = cpu_rq(p->cpu);
+
+		raw_spin_lock(&rq->lock);
+		p->state = e->op == OP_EXIT ? TASK_DEAD : TASK_INTERRUPTIBLE;
+		if (p->on_rq) {
+			flash_sched_class.dequeue_task(rq, p, 0);
+			p->on_rq = 0;
+		}
+		raw_spin_unlock(&rq->lock);
+
+		if (rq->curr == p)
+			replay_schedule(rq);
+		if (e->op == OP_EXIT) {
+			/* As finish_task_switch() for a dead task */
+			if (p->flash.dl_bw)
+				flash_edf_release(p);
+			mock_task_free(p);
+		}
+		break;
+
+	case OP_TICK:
+		mock_clock_advance(MOCK_TICK_NSEC / mock_nr_cpus);
+		mock_run_timers();
+
+		p = rq->curr;
+		if (p->sched_class == &flash_sched_class) {
+			raw_spin_lock(&rq->lock);
+			flash_sched_class.task_tick(rq, p, 0);
+			raw_spin_unlock(&rq->lock);
+		}
+
+		if (p->need_resched)
+			replay_schedule(rq);
+		break;
+
+	case OP_YIELD:
+		if (rq->curr->sched_class == &flash_sched_class) {
+			raw_spin_lock(&rq->lock);
+			flash_sched_class.yield_task(rq);
+			raw_spin_unlock(&rq->lock);
+		}
+		/* fall through */
+	case OP_PICK:
+		replay_schedule(rq);
+		break;
+
+	case OP_OFFLINE:
+		/* sched_cpu_inactive() refuses it under admitted EDF shares */
+		if (cpumask_test_cpu(e->cpu, cpu_active_mask) &&
+		    !flash_edf_cpu_busy())
+			replay_cpu_offline(rq);
+		break;
+
+	case OP_EDF:
+		if (!p)
+			break;
+		rq = cpu_rq(p->cpu);
+
+		/* As __sched_flash_setattr(): admitted off the runqueue */
+		raw_spin_lock(&rq->lock);
+		on_rq = p->on_rq;
+		running = rq->curr == p;
+		if (on_rq)
+			flash_sched_class.dequeue_task(rq, p, 0);
+		if (running)
+			flash_sched_class.put_prev_task(rq, p);
+
+		if (!flash_edf_admit(p, flash_edf_bw(e->dl_runtime_us * 1000ULL,
+						     e->dl_period_us * 1000ULL))) {
+			p->flash.dl_runtime = e->dl_runtime_us * 1000ULL;
+			p->flash.dl_deadline = p->flash.dl_period =
+				e->dl_period_us * 1000ULL;
+			flash_attr_changed(p);
+		}
+
+		if (running)
+			flash_sched_class.set_curr_task(rq);
+		if (on_rq)
+			flash_sched_class.enqueue_task(rq, p, 0);
+		raw_spin_unlock(&rq->lock);
+		break;
+
+	case OP_GANG:
+		if (!p)
+			break;
+		rq = cpu_rq(p->cpu);
+
+		raw_spin_lock(&rq->lock);
+		if (e->tgid)
+			p->tgid = e->tgid;
+		p->flash.gang = !!e->tgid;
+		flash_attr_changed(p);
+		raw_spin_unlock(&rq->lock);
+		break;
+
+	case OP_ONLINE:
+		if (cpumask_test_cpu(e->cpu, cpu_active_mask))
+			break;
+		mock_cpu_active_mask.bits |= 1ULL << e->cpu;
+		raw_spin_lock(&rq->lock);
+		flash_sched_class.rq_online(rq);
+		raw_spin_unlock(&rq->lock);
+		break;
+	}
+}
+
+/*
+ * Measurement
+ */
+
+static inline u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stats_add(struct op_stats *s, u64 ns)
+{
+	int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+	if (!s->count || ns < s->min_ns)
+		s->min_ns = ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+	s->count++;
+	s->total_ns += ns;
+	s->hist[bucket < NR_LAT_BUCKETS ? bucket : NR_LAT_BUCKETS - 1]++;
+}
+
+/* Upper bound of the log2 bucket holding the given percentile */
+static u64 stats_percentile(struct op_stats *s, unsigned int pct)
+{
+	unsigned long want = (s->count * pct + 99) / 100, seen = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < NR_LAT_BUCKETS; bucket++) {
+		seen += s->hist[bucket];
+		if (seen >= want)
+			return bucket ? (1ULL << bucket) - 1 : 0;
+	}
+	return s->max_ns;
+}
+
+enum {
+	PERF_MISSES,
+	PERF_REFS,
+	PERF_INSNS,
+	NR_PERF,
+};
+
+static int perf_fd[NR_PERF] = { -1, -1, -1 };
+
+static int perf_open(u64 config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void perf_start(void)
+{
+	perf_fd[PERF_MISSES] = perf_open(PERF_COUNT_HW_CACHE_MISSES, -1);
+	if (perf_fd[PERF_MISSES] < 0)
+		return;
+	perf_fd[PERF_REFS] = perf_open(PERF_COUNT_HW_CACHE_REFERENCES,
+				       perf_fd[PERF_MISSES]);
+	perf_fd[PERF_INSNS] = perf_open(PERF_COUNT_HW_INSTRUCTIONS,
+					perf_fd[PERF_MISSES]);
+
+	ioctl(perf_fd[PERF_MISSES], PERF_EVENT_IOC_RESET,
+	      PERF_IOC_FLAG_GROUP);
+	ioctl(perf_fd[PERF_MISSES], PERF_EVENT_IOC_ENABLE,
+	      PERF_IOC_FLAG_GROUP);
+}
+
+static void perf_stop(void)
+{
+	if (perf_fd[PERF_MISSES] >= 0)
+		ioctl(perf_fd[PERF_MISSES], PERF_EVENT_IOC_DISABLE,
+		      PERF_IOC_FLAG_GROUP);
+}
+
+static void perf_report(unsigned long nr_events)
+{
+	static const char * const names[NR_PERF] = {
+		"cache-misses", "cache-references", "instructions",
+	};
+	int i;
+
+	for (i = 0; i < NR_PERF; i++) {
+		u64 val;
+
+		if (perf_fd[i] < 0 ||
+		    read(perf_fd[i], &val, sizeof(val)) != sizeof(val)) {
+			printf("%-18s n/a\n", names[i]);
+			continue;
+		}
+		printf("%-18s %llu (%.2f/event)\n", names[i],
+		       (unsigned long long)val,
+		       nr_events ? (double)val / nr_events : 0.0);
+		close(perf_fd[i]);
+	}
+}
+
+static u64 replay(struct replay_trace *t)
+{
+	u64 total = 0;
+	size_t i;
+
+	for (i = 0; i < t->nr; i++) {
+		struct replay_event *e = &t->ev[i];
+		u64 start, ns;
+
+		start = now_ns();
+		replay_event(e);
+		ns = now_ns() - start;
+
+		stats_add(&stats[e->op], ns);
+		total += ns;
+	}
+
+	return total;
+}
+
+/*
+ * With quiet set only the counts are printed, which are the same on every
+ * run of a trace; make check compares them with the .expect files in
+ * traces/.
+ */
+static void report(const char *model, int nr_cpus, int repeat,
+		   unsigned long nr_events, u64 total_ns, u64 wall_ns,
+		   int quiet)
+{
+	int op;
+
+	printf("model              %s\n", model);
+	printf("cpus               %d\n", nr_cpus);
+	printf("events             %lu (x%d)\n", nr_events / repeat, repeat);
+	printf("decisions          %lu (%lu idle, %lu unrunnable)\n",
+	       nr_decisions, nr_idle_decisions, nr_bad_decisions);
+	printf("reschedules        %lu\n", mock_nr_resched);
+	flash_model_report(stdout);
+	if (quiet) {
+		for (op = 0; op < NR_OPS; op++)
+			if (stats[op].count)
+				printf("%-7s %10lu\n", op_names[op],
+				       stats[op].count);
+		return;
+	}
+	printf("decisions/sec      %.0f\n",
+	       total_ns ? nr_decisions * 1e9 / total_ns : 0.0);
+	printf("events/sec         %.0f (wall %.0f)\n",
+	       total_ns ? nr_events * 1e9 / total_ns : 0.0,
+	       wall_ns ? nr_events * 1e9 / wall_ns : 0.0);
+	perf_report(nr_events);
+
+	printf("\n%-7s %10s %8s %8s %8s %8s %8s\n", "op", "count",
+	       "min", "avg", "p50<=", "p99<=", "max");
+	for (op = 0; op < NR_OPS; op++) {
+		struct op_stats *s = &stats[op];
+
+		if (!s->count)
+			continue;
+		printf("%-7s %10lu %8llu %8llu %8llu %8llu %8llu\n",
+		       op_names[op], s->count,
+		       (unsigned long long)s->min_ns,
+		       (unsigned long long)(s->total_ns / s->count),
+		       (unsigned long long)stats_percentile(s, 50),
+		       (unsigned long long)stats_percentile(s, 99),
+		       (unsigned long long)s->max_ns);
+	}
+	printf("(latencies in ns)\n");
+}
+
+/*
+ * Recorded device transactions
+ */
+
+static int record_cmp(const void *a, const void *b)
+{
+	const struct flash_trace_record *ra = a, *rb = b;
+
+	return ra->ts < rb->ts ? -1 : ra->ts > rb->ts;
+}
+
+/*
+ * The model stands in for one device, so only the records of one device
+ * are replayed: dev_id's, or with dev_id negative those of the only
+ * device in the recording.
+ */
+static int record_replay(const char *path, int dev_id)
+{
+	struct flash_trace_record *rec = NULL;
+	struct flash_dev *dev = flash_model_dev();
+	size_t nr = 0, alloc = 0, i;
+	unsigned long nr_sched = 0, nr_agree = 0, nr_read = 0;
+	int ret = 1;
+	FILE *f;
+
+	f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+
+	for (;;) {
+		if (nr == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			rec = realloc(rec, alloc * sizeof(*rec));
+			if (!rec) {
+				perror("realloc");
+				goto out;
+			}
+		}
+		if (fread(&rec[nr], sizeof(*rec), 1, f) != 1)
+			break;
+		nr_read++;
+
+		if (rec[nr].version != FLASH_TRACE_VERSION) {
+			fprintf(stderr, "%s: record %lu is version %u, not %u\n",
+				path, nr_read, rec[nr].version,
+				FLASH_TRACE_VERSION);
+			goto out;
+		}
+		if (dev_id < 0 && nr && rec[nr].dev != rec[0].dev) {
+			fprintf(stderr, "%s: records from devices %u and %u, "
+				"pick one with -d\n", path, rec[0].dev,
+				rec[nr].dev);
+			goto out;
+		}
+		if (dev_id >= 0 && rec[nr].dev != dev_id)
+			continue;
+		nr++;
+	}
+
+	/* Each CPU's buffer is in order; merge them */
+	qsort(rec, nr, sizeof(*rec), record_cmp);
+
+	for (i = 0; i < nr; i++) {
+		flash_arg_t farg = {
+			.type	= rec[i].type,
+			.pid	= rec[i].pid,
+			.pri	= rec[i].pri,
+			.state	= rec[i].state,
+			.gid	= rec[i].gid,
+			.data	= rec[i].data,
+		};
+
+		if (rec[i].kind == FLASH_TRACE_CHANGE) {
+			dev->change_write_to_flash(dev, farg);
+		} else if (rec[i].kind == FLASH_TRACE_SCHED) {
+			nr_sched++;
+			if (dev->sched_write_to_flash(dev, farg) == rec[i].ret)
+				nr_agree++;
+		}
+	}
+
+	printf("records            %zu of %lu\n", nr, nr_read);
+	flash_model_report(stdout);
+	printf("agreement          %lu of %lu sched (%.1f%%)\n", nr_agree,
+	       nr_sched, nr_sched ? 100.0 * nr_agree / nr_sched : 0.0);
+	ret = 0;
+out:
+	if (f != stdin)
+		fclose(f);
+	free(rec);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] <trace | -g ops>\n"
+		"  -m model  device model (default fifo)\n"
+		"  -c cpus   number of CPUs (default 1, max %d)\n"
+		"  -l cpus   CPUs per last-level cache (default 1)\n"
+		"  -n cpus   CPUs per NUMA node (default all)\n"
+		"  -r n      replay the trace n times (default 1)\n"
+		"  -g ops    synthesize a trace of this many events\n"
+		"  -t tasks  tasks in a synthesized trace (default 64)\n"
+		"  -s seed   seed for a synthesized trace (default 1)\n"
+		"  -w file   also write the trace to file\n"
+		"  -b us     sched_flash_runtime_us, -1 for unlimited (default %d)\n"
+		"  -p us     sched_flash_period_us (default %u)\n"
+		"  -v        let the class printk() to stderr\n"
+		"  -q        print only counts, no timings\n"
+		"  -R file   replay recorded device transactions instead\n"
+		"  -d dev    replay only the records of this device\n"
+		"models:\n", prog, NR_CPUS, sysctl_sched_flash_runtime,
+		sysctl_sched_flash_period);
+	flash_model_list(stderr);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *model_name = "fifo", *out = NULL, *recording = NULL;
+	const struct flash_model *model;
+	struct replay_trace trace = { 0 };
+	unsigned long gen_ops = 0, nr_events;
+	int nr_cpus = 1, nr_tasks = 64, repeat = 1, quiet = 0, opt, i;
+	int dev_id = -1;
+	unsigned int seed = 1;
+	u64 total_ns = 0, wall_ns;
+
+	while ((opt = getopt(argc, argv, "m:c:l:n:r:g:t:s:w:b:p:vqR:d:")) != -1) {
+		switch (opt) {
+		case 'm':
+			model_name = optarg;
+			break;
+		case 'c':
+			nr_cpus = atoi(optarg);
+			break;
+		case 'l':
+			mock_llc_size = atoi(optarg);
+			break;
+		case 'n':
+			mock_node_size = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'g':
+			gen_ops = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nr_tasks = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			out = optarg;
+			break;
+		case 'b':
+			sysctl_sched_flash_runtime = atoi(optarg);
+			break;
+		case 'p':
+			sysctl_sched_flash_period = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			mock_verbose = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'R':
+			recording = optarg;
+			break;
+		case 'd':
+			dev_id = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	model = flash_model_find(model_name);
+	if (!model || nr_cpus < 1 || nr_cpus > NR_CPUS || repeat < 1 ||
+	    mock_llc_size < 1 || mock_node_size < 1 ||
+	    nr_tasks < 1 || nr_tasks >= MOCK_PID_MAX ||
+	    dev_id >= FLASH_MAX_DEVS ||
+	    !sysctl_sched_flash_period ||
+	    (sysctl_sched_flash_runtime >= 0 &&
+	     sysctl_sched_flash_runtime > sysctl_sched_flash_period) ||
+	    (!gen_ops && !recording && optind != argc - 1))
+		usage(argv[0]);
+
+	if (recording) {
+		mock_init(nr_cpus);
+		flash_model_attach(model);
+		return record_replay(recording, dev_id);
+	}
+
+	if (gen_ops)
+		trace_generate(&trace, gen_ops, nr_tasks, nr_cpus, seed);
+	else if (trace_load(&trace, argv[optind], nr_cpus))
+		return 1;
+
+	if (out && trace_write(&trace, out))
+		return 1;
+
+	perf_start();
+	wall_ns = now_ns();
+	for (i = 0; i < repeat; i++) {
+		mock_init(nr_cpus);
+		flash_model_attach(model);
+		total_ns += replay(&trace);
+	}
+	wall_ns = now_ns() - wall_ns;
+	perf_stop();
+
+	nr_events = trace.nr * repeat;
+	report(model->name, nr_cpus, repeat, nr_events, total_ns, wall_ns,
+	       quiet);
+
+	free(trace.ev);
+	return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Mock scheduler core for the FLASH user-space harness
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock.h"
+
+int mock_verbose;
+int mock_nr_cpus = 1;
+unsigned long mock_nr_resched;
+
+struct rq mock_runqueues[NR_CPUS];
+struct cpumask mock_cpu_active_mask;
+struct cpumask mock_cpu_possible_mask;
+struct task_struct *mock_current;
+
+int mock_llc_size = 1;
+int mock_node_size = NR_CPUS;
+int mock_nr_nodes = 1;
+struct cpumask mock_node_masks[MAX_NUMNODES];
+struct sched_domain *mock_sd_llc[NR_CPUS];
+static struct sched_domain mock_llc_domains[NR_CPUS];
+
+static struct task_struct *mock_tasks[MOCK_PID_MAX];
+static struct task_struct mock_idle_tasks[NR_CPUS];
+
+static u64 mock_clock;
+
+#define MOCK_NR_TIMERS 8
+static struct hrtimer *mock_timers[MOCK_NR_TIMERS];
+
+/* Everything below FLASH in the class chain is reduced to the idle task */
+const struct sched_class fair_sched_class = {
+	.next = NULL,
+};
+
+void resched_task(struct task_struct *p)
+{
+	p->need_resched = 1;
+	mock_nr_resched++;
+}
+
+void resched_cpu(int cpu)
+{
+	resched_task(cpu_rq(cpu)->curr);
+}
+
+/* sched_flash=default is never given to the harness */
+void sched_flash_make_default(void)
+{
+}
+
+/* As in core.c, over the task table instead of the thread list */
+void sched_flash_resync(struct flash_dev *dev)
+{
+	pid_t pid;
+
+	for (pid = 0; pid < MOCK_PID_MAX; pid++) {
+		struct task_struct *p = mock_tasks[pid];
+
+		if (p && p->sched_class == &flash_sched_class)
+			flash_resync_task(dev, p);
+	}
+}
+
+struct task_struct *find_task_by_vpid(pid_t nr)
+{
+	if (nr <= 0 || nr >= MOCK_PID_MAX)
+		return NULL;
+	return mock_tasks[nr];
+}
+
+struct pid_namespace init_pid_ns;
+
+struct task_struct *find_task_by_pid_ns(pid_t nr, struct pid_namespace *ns)
+{
+	return find_task_by_vpid(nr);
+}
+
+/*
+ * One clock for every CPU: a tick on any CPU moves it by a tick's share
+ * of the CPUs, so each CPU sees about one tick's worth per tick of its own.
+ */
+void mock_clock_advance(u64 ns)
+{
+	int cpu;
+
+	mock_clock += ns;
+	for (cpu = 0; cpu < mock_nr_cpus; cpu++)
+		cpu_rq(cpu)->clock = cpu_rq(cpu)->clock_task = mock_clock;
+}
+
+void hrtimer_init(struct hrtimer *timer, int clock_id, int mode)
+{
+	timer->expires = 0;
+	timer->active = 0;
+}
+
+int hrtimer_active(const struct hrtimer *timer)
+{
+	return timer->active;
+}
+
+ktime_t hrtimer_cb_get_time(struct hrtimer *timer)
+{
+	return mock_clock;
+}
+
+u64 hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval)
+{
+	u64 overrun;
+
+	if (now < timer->expires)
+		return 0;
+
+	overrun = (now - timer->expires) / interval + 1;
+	timer->expires += overrun * interval;
+	return overrun;
+}
+
+void start_bandwidth_timer(struct hrtimer *period_timer, ktime_t period)
+{
+	int i, slot = -1;
+
+	if (period_timer->active)
+		return;
+
+	period_timer->expires = mock_clock;
+	hrtimer_forward(period_timer, mock_clock, period);
+	period_timer->active = 1;
+
+	for (i = 0; i < MOCK_NR_TIMERS; i++) {
+		if (mock_timers[i] == period_timer)
+			return;
+		if (!mock_timers[i] && slot < 0)
+			slot = i;
+	}
+	if (slot >= 0)
+		mock_timers[slot] = period_timer;
+}
+
+void mock_run_timers(void)
+{
+	int i;
+
+	for (i = 0; i < MOCK_NR_TIMERS; i++) {
+		struct hrtimer *timer = mock_timers[i];
+
+		if (!timer || !timer->active || timer->expires > mock_clock)
+			continue;
+		if (timer->function(timer) == HRTIMER_NORESTART)
+			timer->active = 0;
+	}
+}
+
+void mock_init(int nr_cpus)
+{
+	int cpu, pid;
+
+	mock_nr_cpus = nr_cpus;
+	mock_cpu_active_mask.bits = nr_cpus < 64 ? (1ULL << nr_cpus) - 1 : ~0ULL;
+	mock_cpu_possible_mask = mock_cpu_active_mask;
+
+	/* As build_sched_domains() for a machine of mock_llc_size-CPU caches */
+	memset(mock_llc_domains, 0, sizeof(mock_llc_domains));
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		int first = cpu - cpu % mock_llc_size;
+
+		mock_sd_llc[cpu] = NULL;
+		if (mock_llc_size < 2 || cpu >= nr_cpus)
+			continue;
+		mock_llc_domains[first].span.bits |= 1ULL << cpu;
+		mock_sd_llc[cpu] = &mock_llc_domains[first];
+	}
+	/* And of mock_node_size-CPU nodes */
+	memset(mock_node_masks, 0, sizeof(mock_node_masks));
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		mock_node_masks[cpu_to_node(cpu)].bits |= 1ULL << cpu;
+	mock_nr_nodes = cpu_to_node(nr_cpus - 1) + 1;
+
+	mock_clock = 0;
+	memset(mock_timers, 0, sizeof(mock_timers));
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct rq *rq = cpu_rq(cpu);
+		struct task_struct *idle = &mock_idle_tasks[cpu];
+
+		memset(rq, 0, sizeof(*rq));
+		memset(idle, 0, sizeof(*idle));
+
+		idle->prio = MAX_PRIO;
+		idle->sched_class = &fair_sched_class;
+		idle->cpu = cpu;
+		idle->on_rq = 1;
+
+		rq->cpu = cpu;
+		rq->curr = rq->idle = idle;
+		init_flash_rq(&rq->flash, rq);
+	}
+
+	/* As sched_init() */
+	init_flash_bandwidth(&def_flash_bandwidth,
+			     global_flash_period(), global_flash_runtime());
+	mock_current = cpu_rq(0)->curr;
+
+	for (pid = 0; pid < MOCK_PID_MAX; pid++)
+		if (mock_tasks[pid])
+			mock_task_free(mock_tasks[pid]);
+}
+
+struct task_struct *mock_task_new(pid_t pid, int prio, int cpu)
+{
+	struct task_struct *p;
+
+	if (pid <= 0 || pid >= MOCK_PID_MAX || mock_tasks[pid])
+		return NULL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	p->pid = p->tgid = pid;
+	p->prio = p->static_prio = p->normal_prio = prio;
+	p->policy = SCHED_FLASH;
+	p->sched_class = &flash_sched_class;
+	p->state = TASK_RUNNING;
+	p->cpu = cpu;
+	p->cpus_allowed.bits = ~0ULL;
+	p->se.load.weight = 1024;	/* nice 0 */
+	INIT_LIST_HEAD(&p->flash.list);
+	p->flash.numa_node = NUMA_NO_NODE;
+
+	mock_tasks[pid] = p;
+	return p;
+}
+
+void mock_task_free(struct task_struct *p)
+{
+	mock_tasks[p->pid] = NULL;
+	free(p);
+}
+
+int mock_is_idle(struct task_struct *p)
+{
+	return p == cpu_rq(p->cpu)->idle;
+}
@@ -0,0 +1,34 @@
+/*
+ * Harness-side runtime for the mock scheduler core: runqueues, the task
+ * table behind find_task_by_vpid() and the pieces of core.c the replay
+ * drives the FLASH class through.
+ */
+
+#ifndef _MOCK_H
+#define _MOCK_H
+
+#include "mock/sched.h"
+#include "mock/flash_dev.h"
+
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+#define TASK_DEAD		64
+#define TASK_WAKING		256
+
+/* The device carries 16-bit PIDs */
+#define MOCK_PID_MAX		65536
+
+/* HZ=1000 */
+#define MOCK_TICK_NSEC		1000000ULL
+
+extern unsigned long mock_nr_resched;
+
+void mock_init(int nr_cpus);
+struct task_struct *mock_task_new(pid_t pid, int prio, int cpu);
+void mock_task_free(struct task_struct *p);
+int mock_is_idle(struct task_struct *p);
+
+void mock_clock_advance(u64 ns);
+void mock_run_timers(void);
+
+#endif /* _MOCK_H */
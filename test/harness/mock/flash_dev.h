@@ -0,0 +1,7 @@
+#ifndef _MOCK_FLASH_DEV_H
+#define _MOCK_FLASH_DEV_H
+
+/* The device interface is shared with the kernel verbatim. */
+#include "../../../kernel/sched/flash_dev.h"
+
+#endif
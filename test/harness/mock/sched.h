@@ -0,0 +1,648 @@
+/*
+ * Mock of kernel/sched/sched.h for the FLASH user-space harness
+ *
+ * Provides just enough of the kernel's types, list helpers, struct rq
+ * and struct task_struct for kernel/sched/flash.c to build unmodified
+ * as an ordinary user-space object.  Keep the FLASH parts of the
+ * structures in sync with include/linux/sched.h and kernel/sched/sched.h.
+ */
+
+#ifndef _MOCK_SCHED_H
+#define _MOCK_SCHED_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * Basic kernel types
+ */
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int32_t  s32;
+typedef uint64_t u64;
+typedef int64_t  s64;
+typedef int      bool;
+
+#define true	1
+#define false	0
+
+#define __iomem
+
+struct resource {
+	u64 start;
+	u64 end;
+};
+
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define __rcu
+
+#define ACCESS_ONCE(x)	(*(volatile typeof(x) *)&(x))
+#define xchg(ptr, v)	__atomic_exchange_n((ptr), (v), __ATOMIC_SEQ_CST)
+#define cmpxchg(ptr, o, n) ({						\
+	typeof(*(ptr)) __old = (o);					\
+	__atomic_compare_exchange_n((ptr), &__old, (n), 0,		\
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);\
+	__old;								\
+})
+
+typedef struct {
+	long counter;
+} atomic_long_t;
+
+#define atomic_long_read(v)	__atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_long_add(i, v)	__atomic_add_fetch(&(v)->counter, (i), __ATOMIC_RELAXED)
+
+#define min(x, y)	((x) < (y) ? (x) : (y))
+#define max(x, y)	((x) > (y) ? (x) : (y))
+#define min_t(type, x, y)	min((type)(x), (type)(y))
+#define max_t(type, x, y)	max((type)(x), (type)(y))
+
+#define U32_MAX		((u32)~0U)
+#define ULONG_MAX	(~0UL)
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+#define __init
+#define __user
+#define late_initcall(fn)
+#define __setup(str, fn) \
+	static int (*__setup_##fn)(char *) __attribute__((unused)) = fn
+
+/*
+ * printk() is compiled out unless the harness is asked to be verbose:
+ * the kernel's debug prints would otherwise dominate every measurement.
+ */
+extern int mock_verbose;
+#define printk(fmt, ...) \
+	do { if (mock_verbose) fprintf(stderr, fmt, ##__VA_ARGS__); } while (0)
+#define KERN_WARNING		""
+#define pr_info(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+#define printk_sched(fmt, ...)	printk(fmt, ##__VA_ARGS__)
+
+/*
+ * Doubly linked lists, as in include/linux/list.h
+ */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new,
+			      struct list_head *prev, struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move_tail(struct list_head *list,
+				  struct list_head *head)
+{
+	list->next->prev = list->prev;
+	list->prev->next = list->next;
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member) \
+	container_of(ptr, type, member)
+
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_entry((head)->next, typeof(*pos), member),	\
+		n = list_entry(pos->member.next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = n, n = list_entry(n->member.next, typeof(*n), member))
+
+/*
+ * Locking: the replay is single threaded, so locks only need to exist.
+ */
+typedef struct {
+	int locked;
+} raw_spinlock_t;
+
+static inline void raw_spin_lock(raw_spinlock_t *lock)
+{
+	lock->locked = 1;
+}
+
+static inline void raw_spin_unlock(raw_spinlock_t *lock)
+{
+	lock->locked = 0;
+}
+
+static inline void raw_spin_lock_init(raw_spinlock_t *lock)
+{
+	lock->locked = 0;
+}
+
+#define raw_spin_lock_irq(lock)		raw_spin_lock(lock)
+#define raw_spin_unlock_irq(lock)	raw_spin_unlock(lock)
+#define raw_spin_lock_irqsave(lock, flags) \
+	do { (flags) = 0; raw_spin_lock(lock); } while (0)
+#define raw_spin_unlock_irqrestore(lock, flags) \
+	do { (void)(flags); raw_spin_unlock(lock); } while (0)
+
+#define DEFINE_RAW_SPINLOCK(name)	raw_spinlock_t name = { 0 }
+
+struct mutex {
+	int locked;
+};
+
+#define DEFINE_MUTEX(name)	struct mutex name = { 0 }
+
+static inline void mutex_lock(struct mutex *lock)
+{
+	lock->locked = 1;
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+	lock->locked = 0;
+}
+
+/*
+ * RCU: with a single thread every reader is done by the time a pointer
+ * is replaced.
+ */
+#define rcu_dereference(p)		(p)
+#define rcu_dereference_sched(p)	(p)
+#define rcu_access_pointer(p)		(p)
+#define rcu_assign_pointer(p, v)	((p) = (v))
+#define RCU_INIT_POINTER(p, v)		((p) = (v))
+#define rcu_read_lock()			do { } while (0)
+#define rcu_read_unlock()		do { } while (0)
+#define rcu_read_lock_sched()		do { } while (0)
+#define rcu_read_unlock_sched()		do { } while (0)
+#define synchronize_sched()		do { } while (0)
+
+/*
+ * Time and hrtimers.  Time only moves when the replay says so (see
+ * mock_clock_advance()), and expired timers run from mock_run_timers().
+ */
+#define NSEC_PER_USEC	1000ULL
+
+typedef s64 ktime_t;
+
+static inline ktime_t ns_to_ktime(u64 ns)
+{
+	return ns;
+}
+
+static inline s64 ktime_to_ns(ktime_t kt)
+{
+	return kt;
+}
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+#define HRTIMER_MODE_REL	0
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC		1
+#endif
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *);
+	ktime_t expires;
+	int active;
+};
+
+extern void hrtimer_init(struct hrtimer *timer, int clock_id, int mode);
+extern int hrtimer_active(const struct hrtimer *timer);
+extern ktime_t hrtimer_cb_get_time(struct hrtimer *timer);
+extern u64 hrtimer_forward(struct hrtimer *timer, ktime_t now,
+			   ktime_t interval);
+extern void start_bandwidth_timer(struct hrtimer *period_timer,
+				  ktime_t period);
+
+/*
+ * CPUs
+ */
+#ifndef NR_CPUS
+#define NR_CPUS 64
+#endif
+
+extern int mock_nr_cpus;
+
+#define for_each_possible_cpu(cpu) \
+	for ((cpu) = 0; (cpu) < mock_nr_cpus; (cpu)++)
+#define for_each_online_cpu(cpu)	for_each_possible_cpu(cpu)
+#define num_online_cpus()		cpumask_weight(cpu_active_mask)
+
+struct cpumask {
+	u64 bits;
+};
+
+/* CPUs taken down by the replay's "offline" op are cleared here */
+extern struct cpumask mock_cpu_active_mask;
+#define cpu_active_mask		(&mock_cpu_active_mask)
+
+extern struct cpumask mock_cpu_possible_mask;
+#define cpu_possible_mask	(&mock_cpu_possible_mask)
+
+static inline int cpumask_test_cpu(int cpu, const struct cpumask *mask)
+{
+	return (mask->bits >> cpu) & 1;
+}
+
+#define cpu_active(cpu)		cpumask_test_cpu((cpu), cpu_active_mask)
+
+static inline int cpumask_empty(const struct cpumask *mask)
+{
+	return !mask->bits;
+}
+
+static inline void cpumask_copy(struct cpumask *dst, const struct cpumask *src)
+{
+	*dst = *src;
+}
+
+static inline unsigned int cpumask_weight(const struct cpumask *mask)
+{
+	return __builtin_popcountll(mask->bits);
+}
+
+#define for_each_cpu(cpu, mask)						\
+	for_each_possible_cpu(cpu)					\
+		if (!cpumask_test_cpu((cpu), (mask))) {} else
+
+#define for_each_cpu_and(cpu, mask1, mask2)				\
+	for_each_possible_cpu(cpu)					\
+		if (!cpumask_test_cpu((cpu), (mask1)) ||		\
+		    !cpumask_test_cpu((cpu), (mask2))) {} else
+
+/*
+ * Scheduling domains: only the last-level cache one, sd_llc, grouping
+ * mock_llc_size consecutive CPUs (NULL when that is 1).
+ */
+#define SD_BALANCE_EXEC		0x0004
+#define SD_BALANCE_FORK		0x0008
+#define SD_BALANCE_WAKE		0x0010
+
+struct sched_domain {
+	struct cpumask span;
+};
+
+static inline struct cpumask *sched_domain_span(struct sched_domain *sd)
+{
+	return &sd->span;
+}
+
+extern int mock_llc_size;
+extern struct sched_domain *mock_sd_llc[NR_CPUS];
+
+#define per_cpu(var, cpu)	(mock_##var[(cpu)])
+
+static inline int cpus_share_cache(int this_cpu, int that_cpu)
+{
+	return this_cpu / mock_llc_size == that_cpu / mock_llc_size;
+}
+
+/*
+ * NUMA: nodes of mock_node_size consecutive CPUs (one node by default).
+ */
+#define NUMA_NO_NODE		(-1)
+#define MAX_NUMNODES		NR_CPUS
+
+extern int mock_node_size;
+extern int mock_nr_nodes;
+extern struct cpumask mock_node_masks[MAX_NUMNODES];
+
+#define nr_node_ids		mock_nr_nodes
+#define cpu_to_node(cpu)	((cpu) / mock_node_size)
+#define cpumask_of_node(nid)	(&mock_node_masks[(nid)])
+#define for_each_online_node(nid) \
+	for ((nid) = 0; (nid) < mock_nr_nodes; (nid)++)
+
+/*
+ * Priorities, as in include/linux/sched/rt.h
+ */
+#define MAX_USER_RT_PRIO	100
+#define MAX_RT_PRIO		MAX_USER_RT_PRIO
+#define MAX_PRIO		(MAX_RT_PRIO + 40)
+
+#define SCHED_NORMAL		0
+#define SCHED_FIFO		1
+#define SCHED_RR		2
+#define SCHED_FLASH		7
+
+/* EDF parameter bounds, as in include/uapi/linux/sched.h */
+#define SCHED_FLASH_DL_RUNTIME_MIN_NS	1024
+#define SCHED_FLASH_DL_PERIOD_MAX_NS	4000000000ULL
+
+/*
+ * Tasks
+ */
+struct rq;
+struct task_struct;
+
+struct sched_class {
+	const struct sched_class *next;
+
+	void (*enqueue_task) (struct rq *rq, struct task_struct *p, int flags);
+	void (*dequeue_task) (struct rq *rq, struct task_struct *p, int flags);
+	void (*yield_task) (struct rq *rq);
+
+	void (*check_preempt_curr) (struct rq *rq, struct task_struct *p, int flags);
+
+	struct task_struct * (*pick_next_task) (struct rq *rq);
+	void (*put_prev_task) (struct rq *rq, struct task_struct *p);
+
+	int  (*select_task_rq)(struct task_struct *p, int sd_flag, int flags);
+	void (*rq_online)(struct rq *rq);
+	void (*rq_offline)(struct rq *rq);
+
+	void (*set_curr_task) (struct rq *rq);
+	void (*task_tick) (struct rq *rq, struct task_struct *p, int queued);
+	void (*task_fork) (struct task_struct *p);
+
+	void (*switched_from) (struct rq *this_rq, struct task_struct *task);
+	void (*switched_to) (struct rq *this_rq, struct task_struct *task);
+	void (*prio_changed) (struct rq *this_rq, struct task_struct *task,
+			     int oldprio);
+};
+
+struct load_weight {
+	unsigned long weight, inv_weight;
+};
+
+struct sched_statistics {
+	u64 exec_max;
+};
+
+struct sched_entity {
+	struct load_weight load;
+	u64 exec_start;
+	u64 sum_exec_runtime;
+	u64 prev_sum_exec_runtime;
+	struct sched_statistics statistics;
+};
+
+#define schedstat_set(var, val)	do { var = (val); } while (0)
+
+#define MAX_USER_FLASH_PRIO	64
+
+struct sched_flash_entity {
+	struct list_head list;
+	pid_t fork_parent;
+	unsigned char registered;
+	unsigned char batched;
+	unsigned char attr_stale;
+	unsigned char dev_tag;
+	int dev_cpu;
+	unsigned int time_slice;
+	u64 util_stamp;
+	u32 util_avg;
+	int numa_node;
+	u16 weight;
+	u8 latency;
+	u32 slice_us;
+	u8 gang;
+	u64 dl_runtime, dl_deadline, dl_period;
+	unsigned long dl_bw;
+	u64 deadline;
+	s64 runtime;
+};
+
+struct task_struct {
+	volatile long state;
+	int on_rq;
+	int prio, static_prio, normal_prio;
+	unsigned int rt_priority;
+	unsigned int policy;
+	unsigned int sched_reset_on_fork:1;
+	const struct sched_class *sched_class;
+	struct sched_entity se;
+	struct sched_flash_entity flash;
+	pid_t pid;
+	pid_t tgid;
+	struct cpumask cpus_allowed;
+
+	/* harness bookkeeping */
+	int cpu;
+	int need_resched;
+};
+
+/* The task whose context the replayed event runs in */
+extern struct task_struct *mock_current;
+#define current			mock_current
+
+#define smp_processor_id()	(mock_current->cpu)
+
+static inline void set_tsk_need_resched(struct task_struct *p)
+{
+	p->need_resched = 1;
+}
+
+static inline int rt_prio(int prio)
+{
+	return unlikely(prio < MAX_RT_PRIO);
+}
+
+static inline int rt_task(struct task_struct *p)
+{
+	return rt_prio(p->prio);
+}
+
+/*
+ * Runqueues
+ */
+#define RUNTIME_INF	((u64)~0ULL)
+
+extern unsigned int sysctl_sched_flash_period;
+extern int sysctl_sched_flash_runtime;
+
+#define FLASH_RESET_KEEP	0
+#define FLASH_RESET_TO_FLASH	1
+#define FLASH_RESET_TO_NORMAL	2
+
+extern int sysctl_sched_flash_reset_on_fork;
+
+/* HZ=1000 */
+#define FLASH_TIMESLICE		100
+#define usecs_to_jiffies(us)	(((us) + 999) / 1000)
+
+#define FLASH_UTIL_SCALE	1024
+
+struct flash_bandwidth {
+	raw_spinlock_t		flash_runtime_lock;
+	ktime_t			flash_period;
+	u64			flash_runtime;
+	struct hrtimer		flash_period_timer;
+};
+
+static inline int flash_bandwidth_enabled(void)
+{
+	return sysctl_sched_flash_runtime >= 0;
+}
+
+static inline u64 global_flash_period(void)
+{
+	return (u64)sysctl_sched_flash_period * NSEC_PER_USEC;
+}
+
+static inline u64 global_flash_runtime(void)
+{
+	if (sysctl_sched_flash_runtime < 0)
+		return RUNTIME_INF;
+
+	return (u64)sysctl_sched_flash_runtime * NSEC_PER_USEC;
+}
+
+struct flash_rq {
+	int nr_running;
+	struct list_head queue;
+
+	u64 flash_time;
+	int flash_throttled;
+
+	struct flash_dev __rcu *dev;
+	u32 next_pid;
+	unsigned long util_sum;
+	unsigned long util_node;
+	int nr_edf;
+};
+
+struct rq {
+	raw_spinlock_t lock;
+	unsigned int nr_running;
+	struct load_weight load;
+	struct flash_rq flash;
+	struct task_struct *curr, *idle;
+	u64 clock, clock_task;
+	int cpu;
+};
+
+extern struct rq mock_runqueues[NR_CPUS];
+
+static inline void inc_nr_running(struct rq *rq)
+{
+	rq->nr_running++;
+}
+
+static inline void dec_nr_running(struct rq *rq)
+{
+	rq->nr_running--;
+}
+
+static inline void update_load_add(struct load_weight *lw, unsigned long inc)
+{
+	lw->weight += inc;
+	lw->inv_weight = 0;
+}
+
+static inline void update_load_sub(struct load_weight *lw, unsigned long dec)
+{
+	lw->weight -= dec;
+	lw->inv_weight = 0;
+}
+
+#define cpu_rq(cpu)		(&mock_runqueues[(cpu)])
+#define cpu_of(rq)		((rq)->cpu)
+#define task_cpu(p)		((p)->cpu)
+#define tsk_cpus_allowed(p)	(&(p)->cpus_allowed)
+
+static inline void set_task_cpu(struct task_struct *p, unsigned int cpu)
+{
+	p->cpu = cpu;
+}
+
+extern const struct sched_class fair_sched_class;
+extern const struct sched_class flash_sched_class;
+
+extern void resched_task(struct task_struct *p);
+
+/* CPU time accounting outside the class is not modelled */
+#define account_group_exec_runtime(p, delta)	do { } while (0)
+#define cpuacct_charge(p, delta)		do { } while (0)
+#define sched_rt_avg_update(rq, delta)		do { } while (0)
+extern void resched_cpu(int cpu);
+extern struct task_struct *find_task_by_vpid(pid_t nr);
+
+/* One namespace: the PIDs the replay uses are global */
+struct pid_namespace {
+	unsigned int level;
+};
+extern struct pid_namespace init_pid_ns;
+extern struct task_struct *find_task_by_pid_ns(pid_t nr,
+					       struct pid_namespace *ns);
+
+extern void init_flash_rq(struct flash_rq *flash_rq, struct rq *rq);
+
+extern struct flash_bandwidth def_flash_bandwidth;
+extern void init_flash_bandwidth(struct flash_bandwidth *flash_b, u64 period, u64 runtime);
+extern void flash_fork_register(struct task_struct *p);
+extern void sched_flash_make_default(void);
+extern void sched_flash_resync(struct flash_dev *dev);
+extern void flash_resync_task(struct flash_dev *dev, struct task_struct *p);
+extern void flash_batch_begin(void);
+extern void flash_batch_end(void);
+extern void flash_batch_task(struct task_struct *p);
+extern void flash_attr_changed(struct task_struct *p);
+extern unsigned long flash_edf_bw(u64 runtime, u64 period);
+extern int flash_edf_admit(struct task_struct *p, unsigned long bw);
+extern void flash_edf_release(struct task_struct *p);
+extern bool flash_edf_cpu_busy(void);
+extern int move_queued_flash_tasks(struct rq *src_rq, struct rq *dst_rq);
+
+#endif /* _MOCK_SCHED_H */
@@ -0,0 +1,472 @@
+/*
+ * Software models of the FLASH device
+ *
+ * "fifo" keeps the runnable PIDs of each CPU in one round-robin queue,
+ * which is what the current bitstream does.  "prio" keeps one round-robin
+ * queue per 8-bit priority and CPU and always serves the lowest non-empty
+ * level.  Both follow the CPU hotplug operations, and both serve tasks
+ * with a deadline (FLASH_OP_DEADLINE) first, earliest first, from one
+ * deadline-sorted queue per CPU.  Picking a gang member (FLASH_OP_GANG)
+ * posts a queued member to every other CPU that has one, as the
+ * decision interrupt of a FLASH_DEV_GANG device would.
+ * "null" accepts every message and never schedules anything, so a
+ * replay against it measures the class alone.
+ *
+ * Queues are intrusive lists threaded through per-PID arrays so that
+ * every operation is O(1) apart from the priority bitmap scan and the
+ * sorted insert of a task with a deadline.
+ */
+
+#include <string.h>
+
+#include "model.h"
+
+#define FLASH_NR_LEVELS		256
+#define FLASH_LEVEL_WORDS	(FLASH_NR_LEVELS / 64)
+
+static u16 link_next[MOCK_PID_MAX], link_prev[MOCK_PID_MAX];
+static u8 queued[MOCK_PID_MAX];
+static u8 queued_level[MOCK_PID_MAX];
+static u8 queued_cpu[MOCK_PID_MAX];
+static u8 queued_edf[MOCK_PID_MAX];
+static u8 has_deadline[MOCK_PID_MAX];
+static u32 deadline[MOCK_PID_MAX];
+
+static u16 level_head[NR_CPUS][FLASH_NR_LEVELS];
+static u16 level_tail[NR_CPUS][FLASH_NR_LEVELS];
+static u64 level_bitmap[NR_CPUS][FLASH_LEVEL_WORDS];
+static u16 edf_head[NR_CPUS];
+static u16 gang_of[MOCK_PID_MAX], gang_head[MOCK_PID_MAX];
+static u16 gang_next[MOCK_PID_MAX], gang_prev[MOCK_PID_MAX];
+static unsigned long nr_gang_posts;
+static u8 cpu_offline[NR_CPUS];
+
+static void q_reset(void)
+{
+	memset(queued, 0, sizeof(queued));
+	memset(queued_cpu, 0, sizeof(queued_cpu));
+	memset(queued_edf, 0, sizeof(queued_edf));
+	memset(has_deadline, 0, sizeof(has_deadline));
+	memset(edf_head, 0, sizeof(edf_head));
+	memset(gang_of, 0, sizeof(gang_of));
+	memset(gang_head, 0, sizeof(gang_head));
+	memset(level_head, 0, sizeof(level_head));
+	memset(level_tail, 0, sizeof(level_tail));
+	memset(level_bitmap, 0, sizeof(level_bitmap));
+	memset(cpu_offline, 0, sizeof(cpu_offline));
+}
+
+/* Behind every deadline that is not later, as the device compares them */
+static void edf_insert(u16 pid, int cpu)
+{
+	u16 prev = 0, next = edf_head[cpu];
+
+	while (next && (s32)(deadline[next] - deadline[pid]) <= 0) {
+		prev = next;
+		next = link_next[next];
+	}
+
+	link_prev[pid] = prev;
+	link_next[pid] = next;
+	if (prev)
+		link_next[prev] = pid;
+	else
+		edf_head[cpu] = pid;
+	if (next)
+		link_prev[next] = pid;
+}
+
+static void q_insert(u16 pid, int cpu, u8 level)
+{
+	u16 tail = level_tail[cpu][level];
+
+	queued[pid] = 1;
+	queued_level[pid] = level;
+	queued_cpu[pid] = cpu;
+	queued_edf[pid] = has_deadline[pid];
+	if (queued_edf[pid]) {
+		edf_insert(pid, cpu);
+		return;
+	}
+
+	link_next[pid] = 0;
+	link_prev[pid] = tail;
+	if (tail)
+		link_next[tail] = pid;
+	else
+		level_head[cpu][level] = pid;
+	level_tail[cpu][level] = pid;
+	level_bitmap[cpu][level / 64] |= 1ULL << (level % 64);
+}
+
+static void q_remove(u16 pid)
+{
+	u8 level = queued_level[pid];
+	int cpu = queued_cpu[pid];
+	u16 next = link_next[pid], prev = link_prev[pid];
+
+	queued[pid] = 0;
+	if (queued_edf[pid]) {
+		if (prev)
+			link_next[prev] = next;
+		else
+			edf_head[cpu] = next;
+		if (next)
+			link_prev[next] = prev;
+		return;
+	}
+
+	if (prev)
+		link_next[prev] = next;
+	else
+		level_head[cpu][level] = next;
+	if (next)
+		link_prev[next] = prev;
+	else
+		level_tail[cpu][level] = prev;
+	if (!level_head[cpu][level])
+		level_bitmap[cpu][level / 64] &= ~(1ULL << (level % 64));
+}
+
+/*
+ * Serve the earliest deadline, else the head of the CPU's best level
+ * and rotate it to the tail
+ */
+static u16 q_next(int cpu)
+{
+	int word;
+
+	if (cpu >= NR_CPUS || cpu_offline[cpu])
+		return 0;
+	if (edf_head[cpu])
+		return edf_head[cpu];
+
+	for (word = 0; word < FLASH_LEVEL_WORDS; word++) {
+		u8 level;
+		u16 pid;
+
+		if (!level_bitmap[cpu][word])
+			continue;
+
+		level = word * 64 + __builtin_ctzll(level_bitmap[cpu][word]);
+		pid = level_head[cpu][level];
+		if (link_next[pid]) {
+			q_remove(pid);
+			q_insert(pid, cpu, level);
+		}
+		return pid;
+	}
+
+	return 0;
+}
+
+/* Gangs are named by the leader's PID, so one list head per PID will do */
+static void gang_leave(u16 pid)
+{
+	u16 gang = gang_of[pid], next = gang_next[pid], prev = gang_prev[pid];
+
+	if (!gang)
+		return;
+
+	if (prev)
+		gang_next[prev] = next;
+	else
+		gang_head[gang] = next;
+	if (next)
+		gang_prev[next] = prev;
+	gang_of[pid] = 0;
+}
+
+static void gang_join(u16 pid, u32 gang)
+{
+	gang_leave(pid);
+	if (!gang || gang >= MOCK_PID_MAX)
+		return;
+
+	gang_of[pid] = gang;
+	gang_prev[pid] = 0;
+	gang_next[pid] = gang_head[gang];
+	if (gang_head[gang])
+		gang_prev[gang_head[gang]] = pid;
+	gang_head[gang] = pid;
+}
+
+/*
+ * Run the rest of pid's gang alongside it: one queued member for every
+ * other CPU, unless that CPU has a deadline to serve first.  The member
+ * goes to the tail of its level, as if picked there.
+ */
+static void gang_post(u16 pid, int cpu)
+{
+	u64 posted = 1ULL << cpu;
+	u16 member;
+
+	for (member = gang_head[gang_of[pid]]; member;
+	     member = gang_next[member]) {
+		int other = queued_cpu[member];
+
+		if (!queued[member] || (posted & (1ULL << other)) ||
+		    cpu_offline[other] ||
+		    (edf_head[other] && !queued_edf[member]))
+			continue;
+
+		posted |= 1ULL << other;
+		q_remove(member);
+		q_insert(member, other, queued_level[member]);
+		nr_gang_posts++;
+		flash_post_decision(other, member);
+	}
+}
+
+static u16 q_pick(int cpu)
+{
+	u16 pid = q_next(cpu);
+
+	if (pid && gang_of[pid])
+		gang_post(pid, cpu);
+	return pid;
+}
+
+/* Hand every PID queued on src to dst, keeping levels and order */
+static void q_move_cpu(int src, int dst)
+{
+	int level;
+	u16 pid;
+
+	if (src >= NR_CPUS || dst >= NR_CPUS || src == dst)
+		return;
+
+	while ((pid = edf_head[src])) {
+		q_remove(pid);
+		q_insert(pid, dst, queued_level[pid]);
+	}
+
+	for (level = 0; level < FLASH_NR_LEVELS; level++) {
+		while ((pid = level_head[src][level])) {
+			q_remove(pid);
+			q_insert(pid, dst, level);
+		}
+	}
+}
+
+static void q_op(flash_arg_t vla)
+{
+	switch (flash_op(vla.type)) {
+	case FLASH_OP_CPU_ONLINE:
+		if (vla.data < NR_CPUS)
+			cpu_offline[vla.data] = 0;
+		break;
+	case FLASH_OP_CPU_OFFLINE:
+		if (vla.data < NR_CPUS)
+			cpu_offline[vla.data] = 1;
+		break;
+	case FLASH_OP_CPU_MOVE:
+		q_move_cpu(vla.data & 0xffff, vla.data >> 16);
+		break;
+	case FLASH_OP_FORK:
+		if (vla.pid)
+			gang_leave(vla.pid);
+		break;
+	case FLASH_OP_GANG:
+		if (vla.pid)
+			gang_join(vla.pid, vla.data);
+		break;
+	case FLASH_OP_DEADLINE:
+		if (!vla.pid)
+			break;
+		has_deadline[vla.pid] = !!vla.state;
+		deadline[vla.pid] = vla.data;
+		if (queued[vla.pid]) {
+			q_remove(vla.pid);
+			q_insert(vla.pid, queued_cpu[vla.pid],
+				 queued_level[vla.pid]);
+		}
+		break;
+	}
+}
+
+static void q_change(flash_arg_t vla, u8 level)
+{
+	u16 pid = vla.pid;
+	int cpu;
+
+	if (flash_op(vla.type)) {
+		q_op(vla);
+		return;
+	}
+	if (!pid)
+		return;
+	if (vla.type & __FLASH_CHANGE_NEW) {
+		has_deadline[pid] = 0;
+		gang_leave(pid);
+	}
+
+	/* Without data the task goes back to the CPU it was last on */
+	cpu = queued_cpu[pid];
+	if ((vla.type & FLASH_CHANGE_DATA) && vla.data < NR_CPUS)
+		cpu = vla.data;
+
+	if (vla.type & FLASH_CHANGE_STATE) {
+		if (vla.state != TASK_RUNNING && vla.state != TASK_WAKING) {
+			if (queued[pid])
+				q_remove(pid);
+			return;
+		}
+		if (!queued[pid]) {
+			q_insert(pid, cpu, level);
+			return;
+		}
+	}
+
+	if (queued[pid] &&
+	    (queued_cpu[pid] != cpu || queued_edf[pid] != has_deadline[pid] ||
+	     ((vla.type & FLASH_CHANGE_PRI) && queued_level[pid] != level))) {
+		q_remove(pid);
+		q_insert(pid, cpu, level);
+	}
+}
+
+static void fifo_change(struct flash_dev *dev, flash_arg_t vla)
+{
+	q_change(vla, 0);
+}
+
+static void prio_change(struct flash_dev *dev, flash_arg_t vla)
+{
+	q_change(vla, vla.pri);
+}
+
+static uint16_t q_sched(struct flash_dev *dev, flash_arg_t vla)
+{
+	return q_pick(vla.data);
+}
+
+static void null_reset(void)
+{
+}
+
+static void null_change(struct flash_dev *dev, flash_arg_t vla)
+{
+}
+
+static uint16_t null_sched(struct flash_dev *dev, flash_arg_t vla)
+{
+	return 0;
+}
+
+static const struct flash_model flash_models[] = {
+	{
+		.name = "fifo",
+		.desc = "single round-robin queue (current bitstream)",
+		.reset = q_reset,
+		.change_write_to_flash = fifo_change,
+		.sched_write_to_flash = q_sched,
+	},
+	{
+		.name = "prio",
+		.desc = "round-robin per 8-bit priority level, lowest first",
+		.reset = q_reset,
+		.change_write_to_flash = prio_change,
+		.sched_write_to_flash = q_sched,
+	},
+	{
+		.name = "null",
+		.desc = "accepts messages, never schedules (class overhead only)",
+		.reset = null_reset,
+		.change_write_to_flash = null_change,
+		.sched_write_to_flash = null_sched,
+	},
+};
+
+#define NR_MODELS (sizeof(flash_models) / sizeof(flash_models[0]))
+
+static struct flash_dev model_dev;
+static const struct flash_model *model_attached;
+
+/* Messages the model has seen: task changes, then one slot per control op */
+static unsigned long nr_change, nr_sched, nr_op[16];
+
+static const char * const op_names[16] = {
+	[FLASH_OP_GROUP]	= "group",
+	[FLASH_OP_THROTTLE]	= "throttle",
+	[FLASH_OP_UNTHROTTLE]	= "unthrottle",
+	[FLASH_OP_CPU_ONLINE]	= "online",
+	[FLASH_OP_CPU_OFFLINE]	= "offline",
+	[FLASH_OP_CPU_MOVE]	= "move",
+	[FLASH_OP_FORK]		= "fork",
+	[FLASH_OP_BATCH]	= "batch",
+	[FLASH_OP_RUNTIME]	= "runtime",
+	[FLASH_OP_UTIL]		= "util",
+	[FLASH_OP_ATTR]		= "attr",
+	[FLASH_OP_DEADLINE]	= "deadline",
+	[FLASH_OP_GANG]		= "gang",
+};
+
+static void count_change(struct flash_dev *dev, flash_arg_t vla)
+{
+	if (flash_op(vla.type))
+		nr_op[flash_op(vla.type)]++;
+	else
+		nr_change++;
+	model_attached->change_write_to_flash(dev, vla);
+}
+
+static uint16_t count_sched(struct flash_dev *dev, flash_arg_t vla)
+{
+	nr_sched++;
+	return model_attached->sched_write_to_flash(dev, vla);
+}
+
+const struct flash_model *flash_model_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_MODELS; i++)
+		if (!strcmp(flash_models[i].name, name))
+			return &flash_models[i];
+	return NULL;
+}
+
+void flash_model_attach(const struct flash_model *model)
+{
+	model->reset();
+
+	flash_unregister_device(&model_dev);
+	memset(&model_dev, 0, sizeof(model_dev));
+	model_dev.change_write_to_flash = count_change;
+	model_dev.sched_write_to_flash = count_sched;
+	model_dev.flags = FLASH_DEV_RUNTIME | FLASH_DEV_UTIL | FLASH_DEV_ATTR |
+			  FLASH_DEV_DEADLINE | FLASH_DEV_GANG;
+	model_attached = model;
+	flash_register_device(&model_dev);
+}
+
+/* The device the model is attached as, for feeding it recorded messages */
+struct flash_dev *flash_model_dev(void)
+{
+	return &model_dev;
+}
+
+void flash_model_report(FILE *f)
+{
+	int op;
+
+	fprintf(f, "device messages    %lu change, %lu sched", nr_change,
+		nr_sched);
+	for (op = 1; op < 16; op++)
+		if (nr_op[op])
+			fprintf(f, ", %lu %s", nr_op[op],
+				op_names[op] ? op_names[op] : "other");
+	fprintf(f, "\n");
+	if (nr_gang_posts)
+		fprintf(f, "gang decisions     %lu\n", nr_gang_posts);
+}
+
+void flash_model_list(FILE *f)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_MODELS; i++)
+		fprintf(f, "  %-6s %s\n", flash_models[i].name,
+			flash_models[i].desc);
+}
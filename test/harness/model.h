@@ -0,0 +1,31 @@
+/*
+ * Software models of the FLASH device for the user-space harness
+ *
+ * A model stands in for the hardware behind struct flash_dev: it
+ * receives the same change messages the class sends through
+ * change_write_to_flash() and answers sched_write_to_flash() with the
+ * PID it would have scheduled next.
+ */
+
+#ifndef _MODEL_H
+#define _MODEL_H
+
+#include <stdio.h>
+
+#include "mock.h"
+
+struct flash_model {
+	const char *name;
+	const char *desc;
+	void (*reset) (void);
+	void (*change_write_to_flash) (struct flash_dev *dev, flash_arg_t vla);
+	uint16_t (*sched_write_to_flash) (struct flash_dev *dev, flash_arg_t vla);
+};
+
+const struct flash_model *flash_model_find(const char *name);
+void flash_model_attach(const struct flash_model *model);
+struct flash_dev *flash_model_dev(void);
+void flash_model_list(FILE *f);
+void flash_model_report(FILE *f);
+
+#endif /* _MODEL_H */
@@ -23,58 +23,259 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/interrupt.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/topology.h>
 #include "flash.h"
 
 #include <linux/delay.h>
 
 #define DRIVER_NAME "flash"
-#define FLASH_INT_NUM 72
+
+/* Decision register behind the n-th interrupt in the device tree node */
+#define FLASH_DECISION(n) (4 * (n))
 
 /*
  * Information about our device
  */
 /* don't care */
 #include "../../kernel/sched/flash_dev.h"
-extern struct flash_dev *flash;
 
 struct flash_dev flash_dev_info;
 
+/*
+ * A change request is two or three writes to one register and a sched
+ * request a write and a read, so they must not interleave: the class
+ * sends from every CPU at once, and the ioctls and the ring from process
+ * context besides.  Every register access goes under this lock, the
+ * decision interrupt's too: its read could otherwise land between the
+ * write and the read of a sched request.
+ */
+static DEFINE_RAW_SPINLOCK(flash_reg_lock);
+
+/*
+ * Decision interrupts: the n-th interrupt of our node belongs to the n-th
+ * CPU we schedule and tells it, through its own decision register, what
+ * to run next.  CPUs beyond the last interrupt just ask on every pick.
+ * Each interrupt carries its CPU as an affinity hint, which irqbalance
+ * follows, so that the decision lands where it is used instead of being
+ * forwarded as a reschedule IPI.  irq_set_affinity() is not exported to
+ * modules, and the hint survives the CPU going offline and back.
+ */
+struct flash_irq {
+	int irq;
+	int cpu;
+	int index;
+};
+
+static struct flash_irq *flash_irqs;
+static int flash_nr_irqs;
+
 static irqreturn_t flash_interrupt(int irq, void *dev_id)
 {
-	if (irq != FLASH_INT_NUM)
-		return IRQ_NONE;
+	struct flash_irq *fi = dev_id;
+	unsigned long flags;
+	u16 pid;
 
-	flash_dev_info.next_task = ioread32(flash_dev_info.virtbase);
-	flash_dev_info.irq_pending = 1;
+	raw_spin_lock_irqsave(&flash_reg_lock, flags);
+	pid = (u16) ioread32(flash_dev_info.virtbase + FLASH_DECISION(fi->index));
+	raw_spin_unlock_irqrestore(&flash_reg_lock, flags);
+	flash_post_decision(fi->cpu, pid);
 
 	return IRQ_HANDLED;
 }
 
+static void flash_free_irqs(void)
+{
+	while (flash_nr_irqs--) {
+		irq_set_affinity_hint(flash_irqs[flash_nr_irqs].irq, NULL);
+		free_irq(flash_irqs[flash_nr_irqs].irq,
+			 &flash_irqs[flash_nr_irqs]);
+	}
+	flash_nr_irqs = 0;
+	kfree(flash_irqs);
+	flash_irqs = NULL;
+}
+
+static int flash_request_irqs(struct platform_device *pdev)
+{
+	int cpu, irq, ret = 0;
+
+	flash_irqs = kcalloc(cpumask_weight(&flash_dev_info.cpus),
+			     sizeof(*flash_irqs), GFP_KERNEL);
+	if (!flash_irqs)
+		return -ENOMEM;
+
+	for_each_cpu(cpu, &flash_dev_info.cpus) {
+		struct flash_irq *fi = &flash_irqs[flash_nr_irqs];
+
+		irq = platform_get_irq(pdev, flash_nr_irqs);
+		if (irq < 0)
+			break;
+
+		fi->irq = irq;
+		fi->cpu = cpu;
+		fi->index = flash_nr_irqs;
+		ret = request_irq(irq, flash_interrupt, 0, DRIVER_NAME, fi);
+		if (ret < 0) {
+			flash_free_irqs();
+			break;
+		}
+		irq_set_affinity_hint(irq, cpumask_of(cpu));
+		flash_nr_irqs++;
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
 static void change_write_to_flash(struct flash_dev *dev, flash_arg_t vla)
 {
+	unsigned long flags;
 	u64 message = 0;
 
 	message |= ((u64) vla.type  << 0);
 	message |= ((u64) vla.pid   << 8);
 	message |= ((u64) vla.pri   << 24);
 	message |= ((u64) vla.state << 32);
+	message |= ((u64) vla.gid   << 48);
 
+	raw_spin_lock_irqsave(&flash_reg_lock, flags);
 	iowrite32((u32) message,         dev->virtbase + CHANGE_REQ);
 	iowrite32((u32) (message >> 32), dev->virtbase + CHANGE_REQ);
+
+	/* Control operations may carry a third word */
+	if (vla.type & FLASH_CHANGE_DATA)
+		iowrite32(vla.data, dev->virtbase + CHANGE_REQ);
+	raw_spin_unlock_irqrestore(&flash_reg_lock, flags);
 }
 
 static u16 sched_write_to_flash(struct flash_dev *dev, flash_arg_t vla)
 {
 	u16 next_process;
-	u32 message = 0;
+	u32 message = vla.data;	/* the CPU asking */
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&flash_reg_lock, flags);
 	iowrite32(message, dev->virtbase + SCHED_REQ);
 	/* TODO wait until valid data comes in */
 	barrier();
 	next_process = (u16) ioread32(dev->virtbase);
+	raw_spin_unlock_irqrestore(&flash_reg_lock, flags);
 
 	return next_process;
 }
 
+/*
+ * Per-open submission/completion ring, see flash.h
+ */
+struct flash_ring_ctx {
+	struct flash_ring *ring;
+	struct mutex lock;
+};
+
+static int flash_open(struct inode *inode, struct file *f)
+{
+	struct flash_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->ring = vmalloc_user(FLASH_RING_BYTES);
+	if (!ctx->ring) {
+		kfree(ctx);
+		return -ENOMEM;
+	}
+	mutex_init(&ctx->lock);
+
+	f->private_data = ctx;
+	return 0;
+}
+
+static int flash_release(struct inode *inode, struct file *f)
+{
+	struct flash_ring_ctx *ctx = f->private_data;
+
+	vfree(ctx->ring);
+	kfree(ctx);
+	return 0;
+}
+
+static int flash_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	struct flash_ring_ctx *ctx = f->private_data;
+
+	if (vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start > PAGE_ALIGN(FLASH_RING_BYTES))
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+/* Send everything queued on the ring; returns the number of entries sent */
+static long flash_ring_enter(struct flash_ring_ctx *ctx)
+{
+	struct flash_ring *ring = ctx->ring;
+	u32 sq_head, sq_tail, cq_head, cq_tail;
+	long done = 0;
+
+	mutex_lock(&ctx->lock);
+
+	sq_head = ring->sq_head;
+	sq_tail = ACCESS_ONCE(ring->sq_tail);
+	cq_head = ACCESS_ONCE(ring->cq_head);
+	cq_tail = ring->cq_tail;
+	if (sq_tail - sq_head > FLASH_RING_ENTRIES) {
+		mutex_unlock(&ctx->lock);
+		return -EINVAL;
+	}
+	/* Read the entries only after seeing the tail that covers them */
+	smp_rmb();
+
+	while (sq_head != sq_tail && cq_tail - cq_head < FLASH_RING_ENTRIES) {
+		struct flash_sqe *sqe = &ring->sq[sq_head & FLASH_RING_MASK];
+		struct flash_cqe *cqe = &ring->cq[cq_tail & FLASH_RING_MASK];
+		flash_arg_t vla = {
+			.type	= sqe->type,
+			.pid	= sqe->pid,
+			.pri	= sqe->pri,
+			.state	= sqe->state,
+			.gid	= sqe->gid,
+			.data	= sqe->data,
+		};
+
+		cqe->user_data = sqe->user_data;
+		switch (sqe->op) {
+		case FLASH_RING_CHANGE:
+			change_write_to_flash(&flash_dev_info, vla);
+			cqe->res = 0;
+			break;
+		case FLASH_RING_SCHED:
+			cqe->res = sched_write_to_flash(&flash_dev_info, vla);
+			break;
+		default:
+			cqe->res = -EINVAL;
+		}
+
+		sq_head++;
+		cq_tail++;
+		done++;
+
+		/* A full ring is thousands of register round trips */
+		cond_resched();
+	}
+
+	/* Finish with the entries before user space may reuse them */
+	smp_mb();
+	ring->sq_head = sq_head;
+	ring->cq_tail = cq_tail;
+
+	mutex_unlock(&ctx->lock);
+	return done;
+}
+
 /*
  * Handle ioctl() calls from userspace
  */
@@ -83,6 +284,8 @@ static long flash_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 	flash_arg_t vla;
 
 	switch (cmd) {
+	case FLASH_RING_ENTER:
+		return flash_ring_enter(f->private_data);
 	case FLASH_WRITE:
 		if (copy_from_user(&vla, (flash_arg_t *) arg,
 				   sizeof(flash_arg_t)))
@@ -104,6 +307,9 @@ static long flash_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 /* The operations our device knows how to do */
 static const struct file_operations flash_fops = {
 	.owner		= THIS_MODULE,
+	.open		= flash_open,
+	.release	= flash_release,
+	.mmap		= flash_mmap,
 	.unlocked_ioctl = flash_ioctl,
 };
 
@@ -120,7 +326,7 @@ static struct miscdevice flash_misc_device = {
  */
 static int __init flash_probe(struct platform_device *pdev)
 {
-	int ret;
+	int cpu, nid, ret;
 
 	/* Register ourselves as a misc device: creates /dev/flash */
 	ret = misc_register(&flash_misc_device);
@@ -146,13 +352,35 @@ static int __init flash_probe(struct platform_device *pdev)
 		goto out_release_mem_region;
 	}
 
-	/* irq */
-	ret = request_irq(FLASH_INT_NUM, flash_interrupt, 0, DRIVER_NAME, NULL);
+	/*
+	 * A device tree node placed on a NUMA node schedules that node's
+	 * CPUs, the ones not yet online included; otherwise, and on a
+	 * machine with one node (where of_node_to_nid() says 0), we take
+	 * all of them.
+	 */
+	nid = of_node_to_nid(pdev->dev.of_node);
+	cpumask_clear(&flash_dev_info.cpus);
+	if (nid != NUMA_NO_NODE && num_possible_nodes() > 1)
+		for_each_possible_cpu(cpu)
+			if (cpu_to_node(cpu) == nid)
+				cpumask_set_cpu(cpu, &flash_dev_info.cpus);
+	if (cpumask_empty(&flash_dev_info.cpus))
+		cpumask_copy(&flash_dev_info.cpus, cpu_possible_mask);
+
+	/* irqs, one per CPU */
+	ret = flash_request_irqs(pdev);
 	if (ret < 0)
 		goto fail_request_irq;
 
+	/* Only now may the scheduler start talking to us */
+	ret = flash_register_device(&flash_dev_info);
+	if (ret)
+		goto fail_register;
+
 	return 0;
 
+fail_register:
+	flash_free_irqs();
 fail_request_irq:
 	iounmap(flash_dev_info.virtbase);
 out_release_mem_region:
@@ -165,7 +393,9 @@ out_deregister:
 /* Clean-up code: release resources */
 static int flash_remove(struct platform_device *pdev)
 {
-	free_irq(FLASH_INT_NUM, NULL);
+	/* Returns once no CPU can still be calling into us */
+	flash_unregister_device(&flash_dev_info);
+	flash_free_irqs();
 	iounmap(flash_dev_info.virtbase);
 	release_mem_region(flash_dev_info.res.start, resource_size(&flash_dev_info.res));
 	misc_deregister(&flash_misc_device);
@@ -196,7 +426,6 @@ static int __init flash_init(void)
 {
 	flash_dev_info.change_write_to_flash = change_write_to_flash;
 	flash_dev_info.sched_write_to_flash = sched_write_to_flash;
-	flash = &flash_dev_info;
 
 	pr_info(DRIVER_NAME ": init\n");
 	return platform_driver_probe(&flash_driver, flash_probe);
@@ -205,8 +434,6 @@ static int __init flash_init(void)
 /* Called when the module is unloaded: release resources */
 static void __exit flash_exit(void)
 {
-	flash = NULL;
-
 	platform_driver_unregister(&flash_driver);
 	pr_info(DRIVER_NAME ": exit\n");
 }
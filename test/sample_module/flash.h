@@ -2,9 +2,60 @@
 #define _FLASH_H
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 /* ioctls and their arguments */
 #define FLASH_SCHED _IOW('q', 0, flash_arg_t *)
 #define FLASH_WRITE _IOW('q', 1, flash_arg_t *)
+#define FLASH_RING_ENTER _IO('q', 2)
+
+/*
+ * Submission/completion ring shared with user space by mmap() of
+ * /dev/flash (offset 0, FLASH_RING_BYTES long; every open file has its
+ * own ring).  User space fills sq[] entries and advances sq_tail, then
+ * FLASH_RING_ENTER sends everything queued to the device and returns
+ * how many entries it consumed.  Each consumed entry posts one cq[]
+ * entry; a FLASH_RING_SCHED entry completes with the PID the device
+ * returned.  Submission stops early while the completion queue is full.
+ *
+ * Indices run freely and are masked with FLASH_RING_MASK.  The driver
+ * only writes sq_head and cq_tail, user space only sq_tail and cq_head.
+ */
+#define FLASH_RING_ENTRIES	4096
+#define FLASH_RING_MASK		(FLASH_RING_ENTRIES - 1)
+
+#define FLASH_RING_CHANGE	0	/* change_write_to_flash */
+#define FLASH_RING_SCHED	1	/* sched_write_to_flash */
+
+struct flash_sqe {
+	__u8  op;
+	__u8  type;
+	__u16 pid;
+	__u8  pri;
+	__u8  __pad;
+	__u16 state;
+	__u16 gid;
+	__u16 __pad2;
+	__u32 data;
+	__u32 user_data;	/* copied to the completion */
+};
+
+struct flash_cqe {
+	__u32 user_data;
+	__s32 res;		/* returned PID, or -errno */
+};
+
+struct flash_ring {
+	__u32 sq_head;
+	__u32 sq_tail;
+	__u32 __pad[14];	/* keep the two sides on separate lines */
+	__u32 cq_head;
+	__u32 cq_tail;
+	__u32 __pad2[14];
+	struct flash_sqe sq[FLASH_RING_ENTRIES];
+	struct flash_cqe cq[FLASH_RING_ENTRIES];
+};
+
+#define FLASH_RING_BYTES	sizeof(struct flash_ring)
 
 #endif